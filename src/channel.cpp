@@ -5,6 +5,7 @@
  *      Author: nbryskin
  */
 
+#include <poll.h>
 #include <iostream>
 #include <boost/bind.hpp>
 #include <boost/format.hpp>
@@ -13,6 +14,7 @@
 #include "channel.hpp"
 #include "session.hpp"
 #include "statistics.hpp"
+#include "pipe_pool.hpp"
 
 using namespace boost::system;
 
@@ -35,48 +37,81 @@ void asio_handler_invoke(Function function, handler_t** h)
 
 logger channel::log = logger(keywords::channel = "channel");
 
-channel::channel(ip::tcp::socket& input, ip::tcp::socket& output, session& parent_session, const time_duration& input_timeout, bool first_input_stat)
+static const statistics::counter first_received_time_stat("first_received_time", statistics::seconds);
+static const statistics::counter total_splices_stat("total_splices");
+static const statistics::counter total_bytes_stat("total_bytes");
+static const statistics::counter fast_splices_stat("fast_splices");
+static const statistics::counter channel_waits_stat("channel_waits");
+
+channel::channel(ip::tcp::socket& input, ip::tcp::socket& output, session& parent_session, timing_wheel& wheel, const time_duration& input_timeout, long splice_budget, uring* ring, bool first_input_stat)
     : input(input)
     , output(output)
-    , input_timer(input.io_service())
+    , wheel(wheel)
     , input_timeout(input_timeout)
+    , input_deadline(0)
+    , splice_budget(splice_budget)
     , pipe_size(0)
+    , input_left(unlimited)
     , parent_session(parent_session)
     , input_handler(boost::bind(&channel::finished_waiting_input, this, placeholders::error(), placeholders::bytes_transferred()))
     , output_handler(boost::bind(&channel::finished_waiting_output,this, placeholders::error(), placeholders::bytes_transferred()))
+    , ring(ring)
     , current_state(created)
     , first_input(first_input_stat)
 {
-    if (pipe2(pipe, O_NONBLOCK) == -1)
-    {
-        perror("pipe2");
-        throw boost::system::errc::make_error_code(static_cast<boost::system::errc::errc_t> (errno));
-    }
+    // pipe is borrowed from pipe_pool when data starts flowing
+    pipe[0] = pipe[1] = -1;
+    input_timer.set_handler(boost::bind(&channel::input_timeouted, this));
+#ifdef HAVE_IO_URING
+    ring_op.set_handler(boost::bind(&channel::finished_ring_operation, this, _1));
+#endif
 }
 
 channel::~channel()
 {
-    close(pipe[0]);
-    close(pipe[1]);
+    if (pipe[0] == -1)
+        return;
+
+    if (pipe_size == 0)
+        pipe_pool::instance().release(pipe);
+    else
+        pipe_pool::instance().discard(pipe);
 }
 
-void channel::start()
+void channel::start(long limit)
 {
+    input_left = limit;
+#ifdef HAVE_IO_URING
+    if (ring)
+        return start_ring_waiting();
+#endif
     start_waiting();
 }
 
+void channel::cancel()
+{
+#ifdef HAVE_IO_URING
+    if (ring)
+        ring->cancel(ring_op);
+#endif
+}
+
 void channel::start_waiting_input()
 {
     TRACE();
+    statistics::increment(channel_waits_stat);
     current_state = waiting_input;
-    input_timer.expires_from_now(input_timeout);
-    input_timer.async_wait(boost::bind(&channel::input_timeouted, this, placeholders::error()));
+    // timer which is already in the wheel checks input_deadline when it fires
+    input_deadline = wheel.deadline(input_timeout);
+    if (!input_timer.pending())
+        wheel.schedule_at(input_timer, input_deadline);
     input.async_read_some(asio::null_buffers(), &input_handler);
 }
 
 void channel::start_waiting_output()
 {
     TRACE();
+    statistics::increment(channel_waits_stat);
     current_state = waiting_output;
     output.async_write_some(asio::null_buffers(), &output_handler);
 }
@@ -84,15 +119,13 @@ void channel::start_waiting_output()
 void channel::finished_waiting_input(const error_code& ec, std::size_t)
 {
     TRACE_ERROR(ec);
-    input_timer.cancel();
-
     if (ec)
         return finish(ec);
 
     if (first_input)
     {
         first_input = false;
-        statistics::increment("first_received_time", parent_session.timer.elapsed());
+        statistics::increment(first_received_time_stat, parent_session.request_timer.elapsed());
     }
     splice_from_input();
 }
@@ -106,60 +139,100 @@ void channel::finished_waiting_output(const error_code& ec, std::size_t)
     splice_to_output();
 }
 
-void channel::input_timeouted(const error_code& ec)
+void channel::input_timeouted()
 {
-    TRACE_ERROR(ec);
-    if (ec != asio::error::operation_aborted)
-    {
-        error_code tmp_ec;
-        input.cancel(tmp_ec);
-    }
+    TRACE() << current_state;
+    // timeout applies to waiting for input only, next wait re-arms timer
+    if (current_state != waiting_input)
+        return;
+
+    if (wheel.now() < input_deadline)
+        return wheel.schedule_at(input_timer, input_deadline);
+
+    error_code tmp_ec;
+    input.cancel(tmp_ec);
 }
 
+// Splices input -> pipe -> output in place while input has data, output
+// accepts it and splice_budget is not exhausted, so bulk transfers do not
+// pay a reactor round trip per pipe buffer.
 void channel::splice_from_input()
 {
-    error_code ec(0, boost::system::generic_category());
-    std::size_t avail = input.available(ec);
-    if (ec)
-        return finish(ec);
-
-    if (avail == 0)
+    long budget = splice_budget;
+    for (;;)
     {
-        TRACE() << "connection closed";
-        return finish(asio::error::make_error_code(asio::error::eof));
-    }
-    current_state = splicing_input;
+        error_code ec;
+        current_state = splicing_input;
 
-    long spliced;
-    splice(input.native(), pipe[1], spliced, ec);
-    assert(spliced >= 0);
-    pipe_size += spliced;
-    assert(pipe_size >= 0);
-    if (ec)
-        return finish(ec);
+        if (pipe[0] == -1)
+        {
+            pipe_pool::instance().acquire(pipe, ec);
+            if (ec)
+                return finish(ec);
+        }
+
+        if (input_left == 0)
+            break;
+
+        long spliced;
+        splice(input.native(), pipe[1], input_size(), spliced, ec);
+        if (ec == asio::error::try_again)
+            break;
+        if (ec)
+            return finish(ec);
+        if (spliced == 0)
+        {
+            TRACE() << "connection closed";
+            return finish(asio::error::make_error_code(asio::error::eof));
+        }
+        pipe_size += spliced;
+        budget -= spliced;
+        if (input_left != unlimited)
+            input_left -= spliced;
+
+        if (!splice_pipe_to_output())
+            return;
+        if (pipe_size > 0 || budget <= 0)
+            break;
+        statistics::increment(fast_splices_stat);
+    }
 
     finished_splice();
 }
 
 void channel::splice_to_output()
+{
+    if (!splice_pipe_to_output())
+        return;
+
+    // drained pipe means output keeps up, so try input right away
+    if (pipe_size == 0)
+        return splice_from_input();
+
+    finished_splice();
+}
+
+bool channel::splice_pipe_to_output()
 {
     if (!output.is_open())
     {
         TRACE() << "socket closed";
-        return finish(asio::error::make_error_code(asio::error::not_socket));
+        finish(asio::error::make_error_code(asio::error::not_socket));
+        return false;
     }
 
     current_state = splicing_output;
     long spliced;
-    error_code ec(0, asio::error::system_category);
-    splice(pipe[0], output.native(), spliced, ec);
-    assert(spliced >= 0);
+    error_code ec;
+    splice(pipe[0], output.native(), PIPE_SIZE, spliced, ec);
+    if (ec && ec != asio::error::try_again)
+    {
+        finish(ec);
+        return false;
+    }
     pipe_size -= spliced;
     assert(pipe_size >= 0);
-    if (ec)
-        return finish(ec);
-
-    finished_splice();
+    return true;
 }
 
 void channel::finished_splice()
@@ -173,8 +246,25 @@ void channel::start_waiting()
 
     if (pipe_size > 0)
         start_waiting_output();
+    else if (input_left == 0)
+        finished_limit();
     else if (pipe_size < PIPE_SIZE)
+    {
+        // drained pipe is not needed while waiting for input
+        if (pipe[0] != -1)
+            pipe_pool::instance().release(pipe);
         start_waiting_input();
+    }
+}
+
+void channel::finished_limit()
+{
+    TRACE() << parent_session.get_id();
+    current_state = idle;
+    wheel.cancel(input_timer);
+    if (pipe[0] != -1)
+        pipe_pool::instance().release(pipe);
+    parent_session.finished_channel_limit(*this);
 }
 
 void channel::finish(const error_code& ec)
@@ -183,26 +273,146 @@ void channel::finish(const error_code& ec)
     if (ec && ec != asio::error::operation_aborted)
         BOOST_LOG_SEV(log, severity_level::error) << system_error(ec).what();
     current_state = finished;
+    wheel.cancel(input_timer);
     parent_session.finished_channel(ec);
 }
 
-void channel::splice(int from, int to, long& spliced, error_code& ec)
+void channel::splice(int from, int to, long size, long& spliced, error_code& ec)
 {
-    statistics::increment("total_splices");
-    spliced = ::splice(from, 0, to, 0, PIPE_SIZE, SPLICE_F_NONBLOCK | SPLICE_F_MORE | MSG_NOSIGNAL);
+    statistics::increment(total_splices_stat);
+    spliced = ::splice(from, 0, to, 0, size, SPLICE_F_NONBLOCK | SPLICE_F_MORE);
     if (spliced == -1)
     {
         ec = asio::error::make_error_code(static_cast<asio::error::basic_errors>(errno));
         TRACE_ERROR(ec);
         spliced = 0;
-
-        if (ec == asio::error::try_again)
-            ec.clear();
     }
-    statistics::increment("total_bytes", spliced);
+    statistics::increment(total_bytes_stat, spliced);
     TRACE() << spliced << " bytes";
 }
 
+long channel::input_size() const
+{
+    return input_left == unlimited ? PIPE_SIZE : std::min(input_left, PIPE_SIZE);
+}
+
+#ifdef HAVE_IO_URING
+// With io_uring the channel always has exactly one operation in the ring:
+// poll of input with linked receive timeout, splice input -> pipe,
+// splice pipe -> output, or splice pipe -> output linked after poll of output.
+void channel::start_ring_waiting()
+{
+    TRACE() << " pipe_size=" << pipe_size;
+    statistics::increment(channel_waits_stat);
+    if (pipe_size > 0)
+    {
+        current_state = waiting_output;
+        ring->async_poll_splice(output.native(), POLLOUT, pipe[0], output.native(), pipe_size, ring_op);
+    }
+    else if (input_left == 0)
+    {
+        finished_limit();
+    }
+    else
+    {
+        if (pipe[0] != -1)
+            pipe_pool::instance().release(pipe);
+        current_state = waiting_input;
+        ring->async_poll(input.native(), POLLIN, input_timeout, ring_op);
+    }
+}
+
+void channel::start_ring_splice_from_input()
+{
+    if (pipe[0] == -1)
+    {
+        error_code ec;
+        pipe_pool::instance().acquire(pipe, ec);
+        if (ec)
+            return finish(ec);
+    }
+
+    current_state = splicing_input;
+    statistics::increment(total_splices_stat);
+    ring->async_splice(input.native(), pipe[1], input_size(), ring_op);
+}
+
+void channel::finished_ring_operation(int result)
+{
+    TRACE() << current_state << " result=" << result;
+
+    // poll or splice canceled by linked timeout or by session
+    if (result == -ECANCELED)
+        return finish(asio::error::make_error_code(asio::error::operation_aborted));
+
+    switch (current_state)
+    {
+        case waiting_input:
+            if (result < 0)
+                return finish(error_code(-result, get_system_category()));
+            if (first_input)
+            {
+                first_input = false;
+                statistics::increment(first_received_time_stat, parent_session.request_timer.elapsed());
+            }
+            return start_ring_splice_from_input();
+
+        case splicing_input:
+            return finished_ring_splice_from_input(result);
+
+        case splicing_output:
+        case waiting_output:
+            return finished_ring_splice_to_output(result);
+
+        default:
+            assert(false);
+    }
+}
+
+void channel::finished_ring_splice_from_input(int result)
+{
+    if (result == -EAGAIN)
+        return start_ring_waiting();
+    if (result < 0)
+        return finish(error_code(-result, get_system_category()));
+    if (result == 0)
+    {
+        TRACE() << "connection closed";
+        return finish(asio::error::make_error_code(asio::error::eof));
+    }
+
+    pipe_size += result;
+    if (input_left != unlimited)
+        input_left -= result;
+    statistics::increment(total_bytes_stat, long(result));
+    current_state = splicing_output;
+    statistics::increment(total_splices_stat);
+    ring->async_splice(pipe[0], output.native(), pipe_size, ring_op);
+}
+
+void channel::finished_ring_splice_to_output(int result)
+{
+    if (result == -EAGAIN)
+        return start_ring_waiting();
+    if (result < 0)
+        return finish(error_code(-result, get_system_category()));
+
+    pipe_size -= result;
+    assert(pipe_size >= 0);
+
+    if (pipe_size == 0 && input_left == 0)
+        return finished_limit();
+
+    // drained pipe means output keeps up, so splice input right away
+    if (pipe_size == 0)
+    {
+        statistics::increment(fast_splices_stat);
+        return start_ring_splice_from_input();
+    }
+    start_ring_waiting();
+}
+#endif
+
 channel::state channel::get_state() const
 {
     return current_state;
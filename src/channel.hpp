@@ -21,6 +21,9 @@ void asio_handler_invoke(Function function, handler_t** h);
 #include <boost/asio.hpp>
 #include <boost/utility.hpp>
 
+#include "uring.hpp"
+#include "timing_wheel.hpp"
+
 using boost::system::error_code;
 
 class session;
@@ -29,10 +32,18 @@ class channel : public boost::noncopyable
 {
 public:
     // first_input_stat: increment "first_input_time" statistic by elapse from start time
-    channel(ip::tcp::socket& input, ip::tcp::socket& output, session& parent_session, const time_duration& input_timeout, bool first_input_stat=false);
+    // splice_budget: bytes spliced in place after one readiness event before waiting again
+    // ring: io_uring engine to submit polls and splices to, 0 to use asio
+    channel(ip::tcp::socket& input, ip::tcp::socket& output, session& parent_session, timing_wheel& wheel, const time_duration& input_timeout, long splice_budget, uring* ring, bool first_input_stat=false);
     ~channel();
 
-    void start();
+    // limit: bytes spliced from input before session::finished_channel_limit
+    // is called, unlimited splices until input is closed
+    void start(long limit = unlimited);
+    // cancels pending ring operation, sockets are cancelled by session
+    void cancel();
+
+    static const long unlimited = -1;
 
     enum state
     {
@@ -41,6 +52,8 @@ public:
         waiting_output,
         splicing_input,
         splicing_output,
+        // limit is spliced, channel may be started again
+        idle,
         finished,
     };
     state get_state() const;
@@ -53,29 +66,51 @@ protected:
     void finished_waiting_input(const error_code& ec, std::size_t);
     void finished_waiting_output(const error_code& ec, std::size_t);
 
-    void input_timeouted(const error_code& ec);
+    void input_timeouted();
 
     void splice_from_input();
     void splice_to_output();
+    bool splice_pipe_to_output();
 
     void finished_splice();
+    void finished_limit();
     void finish(const error_code& ec);
 
-    void splice(int from, int to, long& spliced, error_code& ec);
+    void splice(int from, int to, long size, long& spliced, error_code& ec);
+    // bytes to splice from input next
+    long input_size() const;
+
+#ifdef HAVE_IO_URING
+    void start_ring_waiting();
+    void start_ring_splice_from_input();
+    void finished_ring_operation(int result);
+    void finished_ring_splice_from_input(int result);
+    void finished_ring_splice_to_output(int result);
+#endif
 
 private:
     ip::tcp::socket& input;
     ip::tcp::socket& output;
-    asio::deadline_timer input_timer;
+    timing_wheel& wheel;
+    timing_wheel::timer input_timer;
     time_duration input_timeout;
+    // input times out at this tick, moved forward by every wait without touching the wheel
+    timing_wheel::tick_t input_deadline;
+    long splice_budget;
     int pipe[2];
     long pipe_size;
+    // bytes left to splice from input or unlimited
+    long input_left;
     session& parent_session;
     static const std::size_t size_of_operation = sizeof(asio::detail::reactive_null_buffers_op<handler_t*>);
     handler_t input_handler;
     char space_for_input_op[size_of_operation];
     handler_t output_handler;
     char space_for_output_op[size_of_operation];
+    uring* ring;
+#ifdef HAVE_IO_URING
+    uring::operation ring_op;
+#endif
 
     // statistics data
     long splices_count;
@@ -106,6 +141,9 @@ stream_type& operator << (stream_type& stream, channel::state state)
         case channel::splicing_output:
             stream << "splicing_output";
             break;
+        case channel::idle:
+            stream << "idle";
+            break;
         case channel::finished:
             stream << "finished";
             break;
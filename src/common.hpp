@@ -29,7 +29,7 @@
 #endif
 
 using boost::log::trivial::severity_level;
-typedef boost::log::sources::severity_channel_logger<severity_level, std::string> logger;
+typedef boost::log::sources::severity_channel_logger_mt<severity_level, std::string> logger;
 
 namespace boost { namespace asio { namespace ip {} namespace placeholders {} namespace local {} } }
 
@@ -0,0 +1,489 @@
+/*
+ * dns_cache.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <boost/bind.hpp>
+
+#include "dns_cache.hpp"
+#include "statistics.hpp"
+
+logger dns_cache::log = logger(keywords::channel = "dns_cache");
+dns_cache* dns_cache::instance_;
+
+static const statistics::counter dns_cache_hits_stat("dns_cache_hits");
+static const statistics::counter dns_cache_negative_hits_stat("dns_cache_negative_hits");
+static const statistics::counter dns_cache_misses_stat("dns_cache_misses");
+static const statistics::counter dns_cache_expired_stat("dns_cache_expired");
+static const statistics::counter dns_cache_evictions_stat("dns_cache_evictions");
+static const statistics::counter dns_cache_size_stat("dns_cache_size");
+static const statistics::counter dns_cache_refreshes_stat("dns_cache_refreshes");
+static const statistics::counter dns_cache_refreshes_limited_stat("dns_cache_refreshes_limited");
+static const statistics::counter dns_cache_snapshot_loads_stat("dns_cache_snapshot_loads");
+static const statistics::counter dns_cache_saves_skipped_stat("dns_cache_saves_skipped");
+
+// Snapshot file layout, native byte order:
+//   header
+//   entries[count], sorted by name hash then name
+//   addresses[address_count], IPv4 ones in mapped form
+//   names[names_size]
+struct dns_cache::snapshot_header
+{
+    char magic[4];
+    std::uint32_t version;
+    std::uint64_t count;
+    std::uint64_t address_count;
+    std::uint64_t names_size;
+};
+
+struct dns_cache::snapshot_entry
+{
+    std::uint64_t hash;
+    std::int64_t expires;
+    std::int32_t error;
+    std::uint32_t ttl;
+    std::uint32_t name_offset;
+    std::uint32_t name_size;
+    std::uint32_t address_offset;
+    std::uint32_t address_count;
+};
+
+static const char snapshot_magic[4] = { 'F', 'P', 'D', 'C' };
+// changed with layout, snapshots of other versions are ignored
+static const std::uint32_t snapshot_version = 1;
+
+typedef ip::address_v6::bytes_type snapshot_address;
+
+// FNV-1a
+static std::uint64_t name_hash(const char* name, std::size_t size)
+{
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (const char* it = name; it != name + size; ++it)
+        hash = (hash ^ static_cast<unsigned char>(*it)) * 1099511628211ULL;
+    return hash;
+}
+
+static std::uint64_t name_hash(const std::string& name)
+{
+    return name_hash(name.data(), name.size());
+}
+
+template<class entry_type>
+struct entry_less
+{
+    explicit entry_less(const std::string& names)
+        : names(names)
+    {
+    }
+
+    bool operator () (const entry_type& lhs, const entry_type& rhs) const
+    {
+        if (lhs.hash != rhs.hash)
+            return lhs.hash < rhs.hash;
+        return names.compare(lhs.name_offset, lhs.name_size, names, rhs.name_offset, rhs.name_size) < 0;
+    }
+
+    bool operator () (const entry_type& lhs, std::uint64_t hash) const
+    {
+        return lhs.hash < hash;
+    }
+
+    const std::string& names;
+};
+
+dns_cache::dns_cache(std::size_t capacity, unsigned min_ttl, unsigned max_ttl, unsigned negative_ttl,
+        unsigned refresh_hits, unsigned refresh_rate)
+    : capacity(capacity)
+    , hand(0)
+    , min_ttl(min_ttl)
+    , max_ttl(std::max(min_ttl, max_ttl))
+    , negative_ttl(negative_ttl)
+    , refresh_hits(refresh_hits)
+    , refresh_rate(refresh_rate)
+    , refresh_second(0)
+    , refresh_count(0)
+    , snapshot(0)
+    , snapshot_size(0)
+    , saving(false)
+{
+    if (capacity == 0)
+        return;
+
+    instance_ = this;
+    slots.reserve(capacity);
+    index.reserve(capacity);
+}
+
+dns_cache::~dns_cache()
+{
+    if (saver.joinable())
+        saver.join();
+    if (snapshot)
+        munmap(const_cast<snapshot_header*>(snapshot), snapshot_size);
+}
+
+dns_cache* dns_cache::instance()
+{
+    return instance_;
+}
+
+bool dns_cache::find(const std::string& name, record& result, bool& refresh)
+{
+    refresh = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::time_t now = std::time(0);
+        index_t::const_iterator it = index.find(name);
+        if (it != index.end())
+        {
+            slot& s = slots[it->second];
+            if (s.expires > now)
+            {
+                s.referenced = true;
+                ++s.hits;
+                result = s.value;
+                refresh = claim_refresh(s, now);
+            }
+            else
+            {
+                // expired slot is kept until it is evicted or refreshed
+                statistics::increment(dns_cache_expired_stat);
+                it = index.end();
+            }
+        }
+        else if (const snapshot_entry* entry = find_snapshot(name))
+        {
+            // entry of snapshot moves into cache on its first lookup
+            if (entry->expires > now && load_snapshot_entry(entry, result))
+            {
+                slot& s = insert_slot(name);
+                s.value = result;
+                s.expires = entry->expires;
+                s.ttl = entry->ttl;
+                s.hits = 1;
+                s.refreshing = false;
+                s.referenced = true;
+                statistics::increment(dns_cache_snapshot_loads_stat);
+                it = index.find(name);
+            }
+        }
+
+        if (it == index.end())
+        {
+            statistics::increment(dns_cache_misses_stat);
+            return false;
+        }
+    }
+
+    statistics::increment(result.error ? dns_cache_negative_hits_stat : dns_cache_hits_stat);
+    return true;
+}
+
+void dns_cache::insert(const std::string& name, const record& value, unsigned ttl)
+{
+    if (value.error)
+        ttl = negative_ttl;
+    else
+        ttl = std::min(std::max(ttl, min_ttl), max_ttl);
+    if (ttl == 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    slot& s = insert_slot(name);
+    s.value = value;
+    s.expires = std::time(0) + ttl;
+    s.ttl = ttl;
+    s.hits = 0;
+    s.refreshing = false;
+    s.referenced = false;
+}
+
+void dns_cache::cancel_refresh(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    index_t::const_iterator it = index.find(name);
+    if (it != index.end())
+        slots[it->second].refreshing = false;
+}
+
+// called with mutex locked, returns slot of name to be filled by caller
+dns_cache::slot& dns_cache::insert_slot(const std::string& name)
+{
+    std::pair<index_t::iterator, bool> inserted = index.insert(index_t::value_type(name, slots.size()));
+    if (inserted.second)
+    {
+        if (slots.size() < capacity)
+        {
+            slots.push_back(slot());
+            statistics::increment(dns_cache_size_stat);
+        }
+        else
+        {
+            inserted.first->second = evict();
+        }
+        slots[inserted.first->second].name = name;
+    }
+    return slots[inserted.first->second];
+}
+
+// called with mutex locked, entry is refreshed once during its life
+bool dns_cache::claim_refresh(slot& s, std::time_t now)
+{
+    if (refresh_hits == 0 || s.refreshing || s.value.error || s.hits < refresh_hits)
+        return false;
+    if (s.expires - now > std::max<std::time_t>(s.ttl / 10, 1))
+        return false;
+
+    if (now != refresh_second)
+    {
+        refresh_second = now;
+        refresh_count = 0;
+    }
+    if (refresh_count == refresh_rate)
+    {
+        // next lookup of the entry tries again
+        statistics::increment(dns_cache_refreshes_limited_stat);
+        return false;
+    }
+
+    ++refresh_count;
+    s.refreshing = true;
+    statistics::increment(dns_cache_refreshes_stat);
+    return true;
+}
+
+// called with mutex locked, returns slot to be reused
+std::size_t dns_cache::evict()
+{
+    for (;; hand = (hand + 1) % slots.size())
+    {
+        slot& s = slots[hand];
+        if (s.referenced && s.expires > std::time(0))
+        {
+            s.referenced = false;
+            continue;
+        }
+
+        TRACE() << s.name;
+        statistics::increment(dns_cache_evictions_stat);
+        index.erase(s.name);
+        std::size_t victim = hand;
+        hand = (hand + 1) % slots.size();
+        return victim;
+    }
+}
+
+void dns_cache::load(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        if (errno != ENOENT)
+            BOOST_LOG_SEV(log, severity_level::warning) << system_error(error_code(errno, boost::system::get_system_category()), path).what();
+        return;
+    }
+
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && std::size_t(st.st_size) >= sizeof(snapshot_header))
+        data = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        BOOST_LOG_SEV(log, severity_level::warning) << "ignoring unreadable snapshot " << path;
+        return;
+    }
+
+    // sections must fill the file exactly, offsets of entries are checked when they are loaded
+    const snapshot_header* header = static_cast<const snapshot_header*>(data);
+    std::uint64_t file_size = st.st_size;
+    bool valid = std::memcmp(header->magic, snapshot_magic, sizeof(snapshot_magic)) == 0
+            && header->version == snapshot_version
+            && header->count <= file_size / sizeof(snapshot_entry)
+            && header->address_count <= file_size / sizeof(snapshot_address)
+            && header->names_size <= file_size
+            && sizeof(snapshot_header) + header->count * sizeof(snapshot_entry)
+                + header->address_count * sizeof(snapshot_address) + header->names_size == file_size;
+    if (!valid)
+    {
+        BOOST_LOG_SEV(log, severity_level::warning) << "ignoring invalid snapshot " << path;
+        munmap(data, st.st_size);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (snapshot)
+        munmap(const_cast<snapshot_header*>(snapshot), snapshot_size);
+    snapshot = header;
+    snapshot_size = st.st_size;
+    TRACE() << path << " " << header->count;
+}
+
+void dns_cache::start_save(const std::string& path)
+{
+    if (saving.exchange(true))
+    {
+        statistics::increment(dns_cache_saves_skipped_stat);
+        return;
+    }
+    if (saver.joinable())
+        saver.join();
+    saver = std::thread(boost::bind(&dns_cache::run_save, this, path));
+}
+
+void dns_cache::run_save(const std::string& path)
+{
+    save(path);
+    saving = false;
+}
+
+void dns_cache::save(const std::string& path)
+{
+    std::lock_guard<std::mutex> save_lock(save_mutex);
+    std::vector<snapshot_entry> entries;
+    std::vector<snapshot_address> addresses;
+    std::string names;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::time_t now = std::time(0);
+        entries.reserve(slots.size());
+        for (std::vector<slot>::const_iterator it = slots.begin(); it != slots.end(); ++it)
+        {
+            if (it->expires <= now)
+                continue;
+
+            snapshot_entry entry;
+            entry.expires = it->expires;
+            entry.error = it->value.error;
+            entry.ttl = it->ttl;
+            entry.name_offset = names.size();
+            entry.name_size = it->name.size();
+            entry.address_offset = addresses.size();
+            entry.address_count = it->value.size;
+            entries.push_back(entry);
+            names += it->name;
+            for (std::size_t i = 0; i < it->value.size; ++i)
+            {
+                const ip::address& address = it->value.addresses[i];
+                addresses.push_back(address.is_v6()
+                        ? address.to_v6().to_bytes()
+                        : ip::address_v6::v4_mapped(address.to_v4()).to_bytes());
+            }
+        }
+
+        // entries of loaded snapshot which were never looked up are kept
+        const snapshot_entry* begin = snapshot ? reinterpret_cast<const snapshot_entry*>(snapshot + 1) : 0;
+        const snapshot_entry* end = snapshot ? begin + snapshot->count : 0;
+        for (const snapshot_entry* it = begin; it != end; ++it)
+        {
+            record value;
+            if (it->expires <= now || !load_snapshot_entry(it, value))
+                continue;
+            std::string name(snapshot_name(it), it->name_size);
+            if (index.count(name))
+                continue;
+
+            snapshot_entry entry = *it;
+            entry.name_offset = names.size();
+            entry.address_offset = addresses.size();
+            entries.push_back(entry);
+            names += name;
+            const snapshot_address* first = reinterpret_cast<const snapshot_address*>(end) + it->address_offset;
+            addresses.insert(addresses.end(), first, first + it->address_count);
+        }
+    }
+
+    // cache is unlocked from here on, lookups of workers do not wait for disk
+    for (std::vector<snapshot_entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+        it->hash = name_hash(names.data() + it->name_offset, it->name_size);
+    std::sort(entries.begin(), entries.end(), entry_less<snapshot_entry>(names));
+
+    snapshot_header header;
+    std::memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+    header.version = snapshot_version;
+    header.count = entries.size();
+    header.address_count = addresses.size();
+    header.names_size = names.size();
+
+    // written aside and renamed, so mapped snapshot is never rewritten in place
+    std::string tmp_path = path + ".tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool written = fd != -1
+            && write(fd, &header, sizeof(header)) == ssize_t(sizeof(header))
+            && write(fd, entries.data(), entries.size() * sizeof(snapshot_entry)) == ssize_t(entries.size() * sizeof(snapshot_entry))
+            && write(fd, addresses.data(), addresses.size() * sizeof(snapshot_address)) == ssize_t(addresses.size() * sizeof(snapshot_address))
+            && write(fd, names.data(), names.size()) == ssize_t(names.size())
+            && fsync(fd) == 0;
+    error_code ec(errno, boost::system::get_system_category());
+    if (fd != -1)
+        close(fd);
+    if (written && rename(tmp_path.c_str(), path.c_str()) == 0)
+    {
+        TRACE() << path << " " << entries.size();
+        return;
+    }
+
+    if (written)
+        ec = error_code(errno, boost::system::get_system_category());
+    BOOST_LOG_SEV(log, severity_level::error) << system_error(ec, tmp_path).what();
+    unlink(tmp_path.c_str());
+}
+
+// called with mutex locked
+const dns_cache::snapshot_entry* dns_cache::find_snapshot(const std::string& name) const
+{
+    if (!snapshot)
+        return 0;
+
+    std::uint64_t hash = name_hash(name);
+    const snapshot_entry* begin = reinterpret_cast<const snapshot_entry*>(snapshot + 1);
+    const snapshot_entry* end = begin + snapshot->count;
+    const snapshot_entry* it = std::lower_bound(begin, end, hash, entry_less<snapshot_entry>(name));
+    for (; it != end && it->hash == hash; ++it)
+    {
+        if (it->name_size == name.size() && it->name_offset + std::uint64_t(it->name_size) <= snapshot->names_size
+                && name.compare(0, name.size(), snapshot_name(it), it->name_size) == 0)
+            return it;
+    }
+    return 0;
+}
+
+// called with mutex locked, false if entry does not fit into its snapshot
+bool dns_cache::load_snapshot_entry(const snapshot_entry* entry, record& value) const
+{
+    if (entry->name_offset + std::uint64_t(entry->name_size) > snapshot->names_size
+            || entry->address_offset + std::uint64_t(entry->address_count) > snapshot->address_count
+            || entry->address_count > max_addresses
+            || (entry->address_count == 0) != (entry->error != 0))
+        return false;
+
+    const snapshot_entry* entries = reinterpret_cast<const snapshot_entry*>(snapshot + 1);
+    const snapshot_address* addresses = reinterpret_cast<const snapshot_address*>(entries + snapshot->count) + entry->address_offset;
+    value.error = entry->error;
+    value.size = entry->address_count;
+    for (std::size_t i = 0; i < value.size; ++i)
+    {
+        ip::address_v6 address(addresses[i]);
+        if (address.is_v4_mapped())
+            value.addresses[i] = address.to_v4();
+        else
+            value.addresses[i] = address;
+    }
+    return true;
+}
+
+const char* dns_cache::snapshot_name(const snapshot_entry* entry) const
+{
+    const snapshot_entry* entries = reinterpret_cast<const snapshot_entry*>(snapshot + 1);
+    const snapshot_address* addresses = reinterpret_cast<const snapshot_address*>(entries + snapshot->count);
+    return reinterpret_cast<const char*>(addresses + snapshot->address_count) + entry->name_offset;
+}
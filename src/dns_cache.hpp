@@ -0,0 +1,119 @@
+/*
+ * dns_cache.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef DNS_CACHE_HPP_
+#define DNS_CACHE_HPP_
+
+#include <ctime>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <unordered_map>
+#include <boost/utility.hpp>
+#include <boost/asio/ip/address.hpp>
+
+#include "common.hpp"
+
+// Process-wide cache of resolved host names shared by resolvers of all workers.
+// Positive entries live for record TTL clamped to [min_ttl, max_ttl], negative
+// ones (NXDOMAIN, SERVFAIL, no data) for negative_ttl. Number of entries is
+// bounded, CLOCK policy evicts entries which were not looked up recently.
+// Entry looked up at least refresh_hits times during its life is hot: lookup
+// in the last tenth of its TTL asks caller to refresh it in background while
+// the entry is still served. Refreshes of all entries are limited to
+// refresh_rate per second.
+// Cache can be saved to a snapshot file and loaded at startup. Loading only maps
+// the file, its entries are moved into cache when they are looked up.
+class dns_cache : public boost::noncopyable
+{
+public:
+    static const std::size_t max_addresses = 16;
+
+    struct record
+    {
+        // 0 or error code of failed lookup (generic category)
+        int error;
+        std::size_t size;
+        ip::address addresses[max_addresses];
+    };
+
+    // ttls are in seconds, refresh_hits 0 disables refreshing
+    dns_cache(std::size_t capacity, unsigned min_ttl, unsigned max_ttl, unsigned negative_ttl,
+            unsigned refresh_hits, unsigned refresh_rate);
+    ~dns_cache();
+
+    // 0 if cache is disabled
+    static dns_cache* instance();
+
+    // fills result with not expired entry of name, refresh is set if caller
+    // has to look the name up again and insert the answer
+    bool find(const std::string& name, record& result, bool& refresh);
+    // ttl of negative entry is always negative_ttl
+    void insert(const std::string& name, const record& value, unsigned ttl);
+    // refresh asked by find() was not started, next lookup asks again
+    void cancel_refresh(const std::string& name);
+
+    // maps snapshot written by save(), missing or invalid file is ignored
+    void load(const std::string& path);
+    // atomically replaces path with cached and not yet loaded snapshot entries;
+    // cache is locked only while its entries are copied
+    void save(const std::string& path);
+    // saves in background thread, skipped while previous save is running
+    void start_save(const std::string& path);
+
+private:
+    struct slot
+    {
+        std::string name;
+        record value;
+        std::time_t expires;
+        unsigned ttl;
+        // lookups since entry was inserted
+        unsigned hits;
+        bool refreshing;
+        bool referenced;
+    };
+
+    typedef std::unordered_map<std::string, std::size_t> index_t;
+
+    struct snapshot_header;
+    struct snapshot_entry;
+
+    slot& insert_slot(const std::string& name);
+    std::size_t evict();
+    bool claim_refresh(slot& s, std::time_t now);
+    void run_save(const std::string& path);
+    const snapshot_entry* find_snapshot(const std::string& name) const;
+    bool load_snapshot_entry(const snapshot_entry* entry, record& value) const;
+    const char* snapshot_name(const snapshot_entry* entry) const;
+
+    std::mutex mutex;
+    std::vector<slot> slots;
+    index_t index;
+    std::size_t capacity;
+    std::size_t hand;
+    unsigned min_ttl;
+    unsigned max_ttl;
+    unsigned negative_ttl;
+    unsigned refresh_hits;
+    unsigned refresh_rate;
+    std::time_t refresh_second;
+    unsigned refresh_count;
+    // mapped snapshot file
+    const snapshot_header* snapshot;
+    std::size_t snapshot_size;
+    // one save at a time, it writes the same temporary file
+    std::mutex save_mutex;
+    std::thread saver;
+    std::atomic<bool> saving;
+
+    static dns_cache* instance_;
+    static logger log;
+};
+
+#endif /* DNS_CACHE_HPP_ */
@@ -0,0 +1,48 @@
+/*
+ * endpoint.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef ENDPOINT_HPP_
+#define ENDPOINT_HPP_
+
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+#include <boost/asio/ip/basic_endpoint.hpp>
+
+#include "common.hpp"
+
+namespace boost { namespace asio { namespace ip {
+
+// reads endpoint of command line option, declared in namespace of endpoint to
+// be found by lexical_cast
+template<class stream_type, class protocol>
+bool operator >> (stream_type& stream, ip::basic_endpoint<protocol>& endpoint)
+{
+    // address[:port], IPv6 address with port is written as [address]:port
+    std::string str;
+    stream >> str;
+    std::string::iterator begin = str.begin();
+    std::string::iterator end = str.end();
+    std::string::iterator colon;
+    if (!str.empty() && str[0] == '[')
+    {
+        ++begin;
+        end = std::find(begin, str.end(), ']');
+        colon = end == str.end() ? end : end + 1;
+    }
+    else if (std::count(str.begin(), str.end(), ':') > 1)
+        colon = str.end();
+    else
+        end = colon = std::find(str.begin(), str.end(), ':');
+    endpoint.address(ip::address::from_string(std::string(begin, end)));
+    if (colon != str.end() && *colon == ':')
+        endpoint.port(atoi(&*colon + 1));
+    return true;
+}
+
+} } }
+
+#endif /* ENDPOINT_HPP_ */
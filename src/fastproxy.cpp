@@ -28,11 +28,17 @@
 #include "fastproxy.hpp"
 #include "proxy.hpp"
 #include "statistics.hpp"
+#include "pipe_pool.hpp"
+#include "dns_cache.hpp"
+#include "peer_scores.hpp"
+#include "hosts_file.hpp"
+#include "endpoint.hpp"
 
 fastproxy* fastproxy::instance_;
 logger fastproxy::log = logger(keywords::channel = "fastproxy");
 
 fastproxy::fastproxy()
+    : dns_cache_timer(io)
 {
     instance_ = this;
 }
@@ -44,31 +50,65 @@ fastproxy& fastproxy::instance()
 
 typedef std::vector<std::string> string_vec;
 typedef std::vector<ip::tcp::endpoint> endpoint_vec;
+typedef std::vector<ip::udp::endpoint> ns_endpoint_vec;
 
 void fastproxy::parse_config(int argc, char* argv[])
 {
     po::options_description desc("Allowed options");
     desc.add_options()
             ("help", "produce help message")
-            ("resolve-library", po::value<std::string>()->default_value("unbound"), "DNS library to use for resolve ('udns', 'unbound')")
+            ("resolve-library", po::value<std::string>()->default_value("unbound"), "DNS library to use for resolve ('udns', 'unbound', 'builtin')")
+            ("workers", po::value<unsigned>()->default_value(1), "number of event loops (threads), every loop listens on all http addresses using SO_REUSEPORT")
+            ("io-engine", po::value<std::string>()->default_value("asio"), "engine for accept, connect and splice ('asio', 'uring'), 'uring' falls back to 'asio' if kernel does not support it")
+            ("uring-entries", po::value<unsigned>()->default_value(4096), "submission queue size of every io_uring")
 
             ("ingoing-http", po::value<endpoint_vec>()->required(), "http listening addresses")
             ("ingoing-stat", po::value<std::string>()->required(), "statistics listening socket")
+            ("accept-batch", po::value<unsigned>()->default_value(1), "connections accepted from listener backlog after one readiness event")
+            ("accepts-per-listener", po::value<unsigned>()->default_value(1), "number of concurrent accept operations on every http listener")
 
             ("outgoing-http", po::value<ip::tcp::endpoint>()->default_value(ip::tcp::endpoint()), "outgoing address for HTTP requests")
+            ("outgoing-http6", po::value<ip::tcp::endpoint>()->default_value(ip::tcp::endpoint(ip::tcp::v6(), 0), "::"), "outgoing address for HTTP requests to IPv6 peers")
             ("outgoing-ns", po::value<ip::udp::endpoint>()->default_value(ip::udp::endpoint()), "outgoing address for NS lookup")
 
             ("log-level", po::value<int>()->default_value(2), "logging level")
             ("log-channel", po::value<string_vec>(), "logging channel")
 
-            ("receive-timeout", po::value<time_duration::sec_type>()->default_value(3600), "timeout for receive operations (in seconds)")
-            ("connect-timeout", po::value<time_duration::sec_type>()->default_value(3), "timeout for connect operation (in seconds)")
-            ("resolve-timeout", po::value<time_duration::sec_type>()->default_value(3), "time out for resolve operation for 'unbound' (in seconds)")
-
-            ("udns-name-server", po::value<ip::udp::endpoint>(), "name server address for 'udns' library")
+            ("receive-timeout", po::value<double>()->default_value(3600), "timeout for receive operations (in seconds)")
+            ("connect-timeout", po::value<double>()->default_value(3), "timeout for connect operation (in seconds)")
+            ("connect-attempt-delay", po::value<long>()->default_value(250), "delay before connecting to next address of peer while previous attempts are in progress (in milliseconds)")
+            ("resolve-timeout", po::value<double>()->default_value(3), "time out for resolve operation for 'unbound' (in seconds)")
+            ("peer-scores-size", po::value<std::size_t>()->default_value(16384), "maximum number of peer addresses ordered by their connect latency and failures, 0 disables ordering")
+            ("timer-resolution", po::value<long>()->default_value(100), "resolution of receive, connect and resolve timeouts (in milliseconds)")
+
+            ("splice-budget", po::value<long>()->default_value(524288), "bytes spliced by channel in place after one readiness event before waiting again")
+            ("pipe-pool-min", po::value<std::size_t>()->default_value(64), "number of splice pipes created at startup")
+            ("pipe-pool-max", po::value<std::size_t>()->default_value(1024), "maximum number of idle splice pipes kept for reuse")
+            ("max-header-size", po::value<std::size_t>()->default_value(65536), "largest request header accepted, headers longer than 4096 bytes are received into pooled buffers of this size")
+            ("client-keep-alive", po::value<bool>()->default_value(false), "keep client connections between requests: request and response are framed (Content-Length, chunked, close) and next request is routed to its own upstream connection, CONNECT and requests which can not be framed are tunneled")
+            ("session-pool-prealloc", po::value<std::size_t>()->default_value(0), "number of session slots allocated by every proxy at startup")
+
+            ("udns-name-server", po::value<ns_endpoint_vec>(), "name server address for 'udns' and 'builtin' libraries, 'unbound' library forwards to it if given, may be given several times")
+            ("builtin-sockets", po::value<std::size_t>()->default_value(4), "number of source ports used by 'builtin' library")
+            ("builtin-query-timeout", po::value<long>()->default_value(1000), "timeout of one try of query sent by 'builtin' library (in milliseconds)")
+            ("builtin-query-attempts", po::value<unsigned>()->default_value(3), "number of tries of query sent by 'builtin' library, every try goes to the next name server")
+            ("resolve-ipv6", po::value<bool>()->default_value(false), "look up IPv6 addresses of peers along with IPv4 ones")
+            ("hosts-file", po::value<std::string>(), "host names connected to fixed addresses without resolving (hosts(5) format), reloaded on SIGHUP")
+            ("dns-cache-size", po::value<std::size_t>()->default_value(65536), "maximum number of cached host names, 0 disables cache")
+            ("dns-cache-min-ttl", po::value<unsigned>()->default_value(1), "minimum time to keep resolved host name (in seconds)")
+            ("dns-cache-max-ttl", po::value<unsigned>()->default_value(3600), "maximum time to keep resolved host name (in seconds)")
+            ("dns-cache-negative-ttl", po::value<unsigned>()->default_value(5), "time to keep failed lookup of host name (in seconds)")
+            ("dns-cache-file", po::value<std::string>()->default_value(""), "snapshot of resolved host names loaded at startup and saved periodically and on exit, empty disables snapshot")
+            ("dns-cache-save-interval", po::value<long>()->default_value(300), "interval of saving snapshot of resolved host names (in seconds)")
+            ("dns-refresh-hits", po::value<unsigned>()->default_value(8), "lookups of cached host name during its TTL which make it refreshed in background before expiry, 0 disables refreshing")
+            ("dns-refresh-rate", po::value<unsigned>()->default_value(100), "maximum number of background refreshes of cached host names per second")
 
             ("allow-header", po::value<string_vec>()->default_value(string_vec(), "any"), "allowed header for requests")
             ("rename-header", po::value<string_vec>()->default_value(string_vec(), ""), "header rename rule (<original name>:<new name>), only allowed headers are supported")
+            ("set-header", po::value<string_vec>()->default_value(string_vec(), ""), "header value rule (<name>:<value>), header of request is replaced or added")
+            ("add-header", po::value<string_vec>()->default_value(string_vec(), ""), "header added to requests (<name>:<value>)")
+            ("forwarded-for", po::value<bool>()->default_value(false), "add X-Forwarded-For header with client address to requests")
+            ("via", po::value<std::string>()->default_value(""), "add Via header with this pseudonym to requests, empty disables it")
 
             ("stat-socket-user", po::value<std::string>()->default_value(getpwuid(getuid())->pw_name), "user for statistics socket")
             ("stat-socket-group", po::value<std::string>()->default_value(getgrgid(getgid())->gr_name), "group for statistics socket")
@@ -87,7 +127,7 @@ void fastproxy::parse_config(int argc, char* argv[])
         }
 
         std::string resolve_library = vm["resolve-library"].as<std::string>();
-        if (resolve_library == "udns")
+        if (resolve_library == "udns" || resolve_library == "builtin")
         {
             if (vm.count("udns-name-server") == 0)
             {
@@ -102,6 +142,55 @@ void fastproxy::parse_config(int argc, char* argv[])
         {
             throw boost::program_options::invalid_option_value(resolve_library);
         }
+
+        std::string io_engine = vm["io-engine"].as<std::string>();
+        if (io_engine != "asio" && io_engine != "uring")
+        {
+            throw boost::program_options::invalid_option_value(io_engine);
+        }
+
+        if (vm["timer-resolution"].as<long>() <= 0)
+        {
+            throw boost::program_options::invalid_option_value("timer-resolution");
+        }
+
+        if (vm["accept-batch"].as<unsigned>() == 0)
+        {
+            throw boost::program_options::invalid_option_value("accept-batch");
+        }
+
+        if (vm["accepts-per-listener"].as<unsigned>() == 0)
+        {
+            throw boost::program_options::invalid_option_value("accepts-per-listener");
+        }
+
+        if (vm["workers"].as<unsigned>() == 0)
+        {
+            throw boost::program_options::invalid_option_value("workers");
+        }
+
+        if (vm["dns-cache-save-interval"].as<long>() <= 0)
+        {
+            throw boost::program_options::invalid_option_value("dns-cache-save-interval");
+        }
+
+        // added lines are sent as is, so they must not break header
+        const char* header_rules[] = { "set-header", "add-header" };
+        for (std::size_t i = 0; i < sizeof(header_rules) / sizeof(header_rules[0]); ++i)
+        {
+            string_vec rules = vm[header_rules[i]].as<string_vec>();
+            for (string_vec::const_iterator it = rules.begin(); it != rules.end(); ++it)
+            {
+                if (it->find(':') == 0 || it->find(':') == std::string::npos || it->find_first_of("\r\n") != std::string::npos)
+                {
+                    throw boost::program_options::invalid_option_value(*it);
+                }
+            }
+        }
+        if (vm["via"].as<std::string>().find_first_of("\r\n") != std::string::npos)
+        {
+            throw boost::program_options::invalid_option_value("via");
+        }
         po::notify(vm);
     }
     catch (const boost::program_options::error& exc)
@@ -158,12 +247,24 @@ void fastproxy::init_signals()
     sw->add_signal(SIGTERM);
     sw->add_signal(SIGQUIT);
     sw->add_signal(SIGINT);
+    sw->add_signal(SIGHUP);
     start_waiting_for_quit();
 }
 
 void fastproxy::start_waiting_for_quit()
 {
-    sw->async_wait(boost::bind(&fastproxy::quit, this, placeholders::error()));
+    sw->async_wait(boost::bind(&fastproxy::finished_waiting_signal, this, _1, _2));
+}
+
+void fastproxy::finished_waiting_signal(const error_code& ec, int signal)
+{
+    if (ec || signal != SIGHUP)
+        return quit(ec);
+
+    // SIGHUP reloads hosts file
+    if (hf)
+        hf->reload();
+    start_waiting_for_quit();
 }
 
 void fastproxy::quit(const error_code& ec)
@@ -202,45 +303,127 @@ void fastproxy::init_statistics()
         perror(("chown(" + stat_sock + ", " + vm["stat-socket-user"].as<std::string>() + ", " + vm["stat-socket-group"].as<std::string>() + ")").c_str());
 }
 
+void fastproxy::init_pipe_pool()
+{
+    pp.reset(new pipe_pool(vm["pipe-pool-min"].as<std::size_t>(), vm["pipe-pool-max"].as<std::size_t>()));
+}
+
+void fastproxy::init_peer_scores()
+{
+    // failed attempt costs as much as waiting for connect timeout
+    ps.reset(new peer_scores(vm["peer-scores-size"].as<std::size_t>(), seconds_option("connect-timeout")));
+}
+
 void fastproxy::init_proxy()
 {
-    bool use_unbound_resolve = (vm["resolve-library"].as<std::string>() == "unbound");
+    unsigned workers_count = vm["workers"].as<unsigned>();
+    bool reuse_port = workers_count > 1;
+
+    // main thread serves the first set of listeners, every additional worker
+    // gets its own io_service and proxy
+    p.reset(create_proxy(io, reuse_port));
+    for (unsigned i = 1; i < workers_count; ++i)
+    {
+        workers.push_back(new worker());
+        workers.back().set_proxy(create_proxy(workers.back().get_io_service(), reuse_port));
+    }
+}
+
+proxy* fastproxy::create_proxy(asio::io_service& io, bool reuse_port)
+{
+    const std::string& library = vm["resolve-library"].as<std::string>();
+    resolver::library resolve_library = library == "unbound" ? resolver::unbound : library == "builtin" ? resolver::builtin : resolver::udns;
+
+    ns_endpoint_vec name_servers;
 
-    ip::udp::endpoint name_server;
+    if (vm.count("udns-name-server"))
+    {
+        name_servers = vm["udns-name-server"].as<ns_endpoint_vec>();
+    }
 
-    if (!use_unbound_resolve)
+    stub_resolver::config stub_config;
+    stub_config.sockets = vm["builtin-sockets"].as<std::size_t>();
+    stub_config.timeout = boost::posix_time::milliseconds(vm["builtin-query-timeout"].as<long>());
+    stub_config.attempts = vm["builtin-query-attempts"].as<unsigned>();
+
+    unsigned uring_entries = 0;
+    if (vm["io-engine"].as<std::string>() == "uring")
     {
-        name_server = vm["udns-name-server"].as<ip::udp::endpoint>();
+        uring_entries = vm["uring-entries"].as<unsigned>();
     }
 
-    p.reset(new proxy(io, vm["ingoing-http"].as<endpoint_vec>(),
+    return new proxy(io, vm["ingoing-http"].as<endpoint_vec>(),
             vm["outgoing-http"].as<ip::tcp::endpoint>(),
+            vm["outgoing-http6"].as<ip::tcp::endpoint>(),
             vm["outgoing-ns"].as<ip::udp::endpoint>(),
-            name_server,
-            boost::posix_time::seconds(vm["receive-timeout"].as<time_duration::sec_type>()),
-            boost::posix_time::seconds(vm["connect-timeout"].as<time_duration::sec_type>()),
-            boost::posix_time::seconds(vm["resolve-timeout"].as<time_duration::sec_type>()),
+            name_servers,
+            seconds_option("receive-timeout"),
+            seconds_option("connect-timeout"),
+            boost::posix_time::milliseconds(vm["connect-attempt-delay"].as<long>()),
+            seconds_option("resolve-timeout"),
+            boost::posix_time::milliseconds(vm["timer-resolution"].as<long>()),
+            vm["splice-budget"].as<long>(),
             vm["allow-header"].as<string_vec>(),
             vm["rename-header"].as<string_vec>(),
+            vm["set-header"].as<string_vec>(),
+            vm["add-header"].as<string_vec>(),
+            vm["forwarded-for"].as<bool>(),
+            vm["via"].as<std::string>(),
             vm["error-page-dir"].as<std::string>(),
-            use_unbound_resolve));
+            resolve_library,
+            stub_config,
+            vm["resolve-ipv6"].as<bool>(),
+            reuse_port,
+            uring_entries,
+            vm["session-pool-prealloc"].as<std::size_t>(),
+            vm["accept-batch"].as<unsigned>(),
+            vm["accepts-per-listener"].as<unsigned>(),
+            vm["max-header-size"].as<std::size_t>(),
+            vm["client-keep-alive"].as<bool>());
+}
+
+time_duration fastproxy::seconds_option(const char* name) const
+{
+    return boost::posix_time::microseconds(static_cast<long>(vm[name].as<double>() * 1e6));
 }
 
 void fastproxy::init_resolver()
 {
     resolver::init();
+    dc.reset(new dns_cache(vm["dns-cache-size"].as<std::size_t>(),
+            vm["dns-cache-min-ttl"].as<unsigned>(),
+            vm["dns-cache-max-ttl"].as<unsigned>(),
+            vm["dns-cache-negative-ttl"].as<unsigned>(),
+            vm["dns-refresh-hits"].as<unsigned>(),
+            vm["dns-refresh-rate"].as<unsigned>()));
+    // disabled cache neither loads nor saves snapshot
+    if (dns_cache::instance() && !vm["dns-cache-file"].as<std::string>().empty())
+        dc->load(vm["dns-cache-file"].as<std::string>());
+    if (vm.count("hosts-file"))
+        hf.reset(new hosts_file(vm["hosts-file"].as<std::string>()));
+}
+
+void fastproxy::start_waiting_dns_cache_save()
+{
+    dns_cache_timer.expires_from_now(boost::posix_time::seconds(vm["dns-cache-save-interval"].as<long>()));
+    dns_cache_timer.async_wait(boost::bind(&fastproxy::finished_waiting_dns_cache_save, this, placeholders::error()));
 }
 
-template<class stream_type, class protocol>
-bool operator >> (stream_type& stream, ip::basic_endpoint<protocol>& endpoint)
+void fastproxy::finished_waiting_dns_cache_save(const error_code& ec)
 {
-    std::string str;
-    stream >> str;
-    std::string::iterator colon = std::find(str.begin(), str.end(), ':');
-    endpoint.address(ip::address::from_string(std::string(str.begin(), colon)));
-    if (colon != str.end())
-        endpoint.port(atoi(&*colon + 1));
-    return true;
+    TRACE_ERROR(ec);
+    if (ec)
+        return;
+
+    // written and synced off the event loop, which serves sessions too
+    dc->start_save(vm["dns-cache-file"].as<std::string>());
+    start_waiting_dns_cache_save();
+}
+
+void fastproxy::save_dns_cache()
+{
+    if (dns_cache::instance() && !vm["dns-cache-file"].as<std::string>().empty())
+        dc->save(vm["dns-cache-file"].as<std::string>());
 }
 
 proxy* fastproxy::find_proxy()
@@ -256,6 +439,8 @@ void fastproxy::init(int argc, char* argv[])
     init_signals();
 
     init_statistics();
+    init_pipe_pool();
+    init_peer_scores();
     init_proxy();
 
     if (vm["stop-after-init"].as<bool>())
@@ -266,18 +451,18 @@ void fastproxy::run()
 {
     s->start();
     p->start();
-
-//    io.run();
-    for (;;)
-    {
-        if (io.poll() == 0)
-        {
-            if (io.run_one() == 0)
-                break;
-            statistics::increment("runs");
-        }
-        statistics::increment("loops");
-    }
+    for (boost::ptr_vector<worker>::iterator it = workers.begin(); it != workers.end(); ++it)
+        it->start();
+    if (dns_cache::instance() && !vm["dns-cache-file"].as<std::string>().empty())
+        start_waiting_dns_cache_save();
+
+    worker::run(io);
+
+    for (boost::ptr_vector<worker>::iterator it = workers.begin(); it != workers.end(); ++it)
+        it->stop();
+    for (boost::ptr_vector<worker>::iterator it = workers.begin(); it != workers.end(); ++it)
+        it->join();
+    save_dns_cache();
 }
 
 void terminate()
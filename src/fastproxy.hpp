@@ -10,12 +10,18 @@
 
 #include <set>
 #include <boost/program_options.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
 
 #include "signal.hpp"
 #include "common.hpp"
+#include "worker.hpp"
 
 class proxy;
 class statistics;
+class pipe_pool;
+class dns_cache;
+class peer_scores;
+class hosts_file;
 
 namespace po = boost::program_options;
 
@@ -37,18 +43,34 @@ private:
     void init_resolver();
     void init_signals();
     void init_statistics();
+    void init_pipe_pool();
+    void init_peer_scores();
     void init_proxy();
+    proxy* create_proxy(asio::io_service& io, bool reuse_port);
+    // fractional seconds option value
+    time_duration seconds_option(const char* name) const;
 
     void start_waiting_for_quit();
+    void finished_waiting_signal(const error_code& ec, int signal);
     void quit(const error_code& ec);
 
+    void start_waiting_dns_cache_save();
+    void finished_waiting_dns_cache_save(const error_code& ec);
+    void save_dns_cache();
+
     bool check_channel_impl(const std::string& channel) const;
     friend bool check_channel(const std::string& channel);
 
     po::variables_map vm;
     asio::io_service io;
+    asio::deadline_timer dns_cache_timer;
     std::unique_ptr<statistics> s;
+    std::unique_ptr<pipe_pool> pp;
+    std::unique_ptr<dns_cache> dc;
+    std::unique_ptr<peer_scores> ps;
+    std::unique_ptr<hosts_file> hf;
     std::unique_ptr<proxy> p;
+    boost::ptr_vector<worker> workers;
     std::unique_ptr<signal_waiter> sw;
     std::set<std::string> channels;
     static fastproxy* instance_;
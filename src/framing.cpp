@@ -0,0 +1,315 @@
+/*
+ * framing.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "framing.hpp"
+#include "scan.hpp"
+
+// longest chunk size accepted, larger ones fail the body
+static const std::uint64_t max_chunk_size = std::uint64_t(1) << 48;
+
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// whether [begin, end) is name ignoring case
+static bool equal_nocase(const char* begin, const char* end, const char* name, std::size_t size)
+{
+    return std::size_t(end - begin) == size && scan::mismatch_nocase(begin, name, size) == size;
+}
+
+template<std::size_t size>
+static bool equal_nocase(const char* begin, const char* end, const char (&name)[size])
+{
+    return equal_nocase(begin, end, name, size - 1);
+}
+
+// calls token(begin, end) for every comma separated token of value
+template<class function>
+static void for_each_token(const char* begin, const char* end, function& token)
+{
+    while (begin != end)
+    {
+        const char* comma = scan::find(begin, end, ',');
+        const char* token_begin = begin;
+        const char* token_end = comma;
+        while (token_begin != token_end && is_space(*token_begin))
+            ++token_begin;
+        while (token_end != token_begin && is_space(token_end[-1]))
+            --token_end;
+        if (token_begin != token_end)
+            token(token_begin, token_end);
+        begin = comma == end ? end : comma + 1;
+    }
+}
+
+struct connection_token
+{
+    explicit connection_token(message_fields& fields)
+        : fields(fields)
+    {
+    }
+
+    void operator () (const char* begin, const char* end)
+    {
+        if (equal_nocase(begin, end, "close"))
+            fields.close = true;
+        else if (equal_nocase(begin, end, "keep-alive"))
+            fields.keep_alive = true;
+        else if (equal_nocase(begin, end, "upgrade"))
+            fields.upgrade = true;
+    }
+
+    message_fields& fields;
+};
+
+// chunked is the last coding, others make body end with connection
+struct encoding_token
+{
+    encoding_token()
+        : chunked(false)
+    {
+    }
+
+    void operator () (const char* begin, const char* end)
+    {
+        chunked = equal_nocase(begin, end, "chunked");
+    }
+
+    bool chunked;
+};
+
+const char* find_header_end(const char* from, const char* end)
+{
+    for (const char* lf = from; (lf = scan::find(lf, end, '\n')) != end; ++lf)
+    {
+        if (lf + 1 != end && lf[1] == '\n')
+            return lf + 2;
+        if (lf + 2 < end && lf[1] == '\r' && lf[2] == '\n')
+            return lf + 3;
+    }
+    return 0;
+}
+
+bool is_http10_line(const char* begin, const char* end)
+{
+    static const char http10[] = "HTTP/1.0";
+    const std::size_t size = sizeof(http10) - 1;
+    if (std::size_t(end - begin) >= size && std::equal(http10, http10 + size, begin))
+        return true;
+    while (end != begin && is_space(end[-1]))
+        --end;
+    return std::size_t(end - begin) >= size && std::equal(http10, http10 + size, end - size);
+}
+
+int parse_status(const char* begin, const char* end)
+{
+    // HTTP/1.x 200 OK
+    static const char http1[] = "HTTP/1.";
+    if (std::size_t(end - begin) < sizeof(http1) - 1 + 5 || !std::equal(http1, http1 + sizeof(http1) - 1, begin))
+        return 0;
+    const char* code = begin + sizeof(http1);
+    if (*code != ' ')
+        return 0;
+    int status = 0;
+    for (++code; code != end && *code >= '0' && *code <= '9'; ++code)
+        status = status * 10 + (*code - '0');
+    return status >= 100 && status < 1000 ? status : 0;
+}
+
+message_fields::message_fields()
+    : close(false)
+    , keep_alive(false)
+    , upgrade(false)
+    , expect(false)
+    , chunked(false)
+    , has_length(false)
+    , length(0)
+    , bad_length(false)
+{
+}
+
+void message_fields::parse(const char* begin, const char* end)
+{
+    bool encoded = false;
+    for (const char* line = begin; line != end; )
+    {
+        const char* line_end = scan::find(line, end, '\n');
+        const char* colon = scan::find(line, line_end, ':');
+        const char* name = line;
+        line = line_end == end ? end : line_end + 1;
+        if (colon == line_end)
+            continue;
+
+        const char* value = colon + 1;
+        while (value != line_end && is_space(*value))
+            ++value;
+        const char* value_end = line_end;
+        while (value_end != value && is_space(value_end[-1]))
+            --value_end;
+
+        if (equal_nocase(name, colon, "Connection") || equal_nocase(name, colon, "Proxy-Connection"))
+        {
+            connection_token token(*this);
+            for_each_token(value, value_end, token);
+        }
+        else if (equal_nocase(name, colon, "Transfer-Encoding"))
+        {
+            encoding_token token;
+            for_each_token(value, value_end, token);
+            encoded = true;
+            chunked = token.chunked;
+        }
+        else if (equal_nocase(name, colon, "Content-Length"))
+        {
+            std::uint64_t n = 0;
+            const char* digit = value;
+            for (; digit != value_end && *digit >= '0' && *digit <= '9' && n < max_chunk_size; ++digit)
+                n = n * 10 + (*digit - '0');
+            if (digit == value || digit != value_end || (has_length && n != length))
+                bad_length = true;
+            has_length = true;
+            length = n;
+        }
+        else if (equal_nocase(name, colon, "Upgrade"))
+        {
+            upgrade = true;
+        }
+        else if (equal_nocase(name, colon, "Expect"))
+        {
+            expect = true;
+        }
+    }
+
+    // Transfer-Encoding overrides Content-Length, unknown coding ends with connection
+    if (encoded)
+    {
+        has_length = false;
+        bad_length = !chunked;
+    }
+}
+
+body_framing::body_framing()
+    : current(done)
+    , remaining(0)
+{
+}
+
+void body_framing::start_length(std::uint64_t length)
+{
+    current = length == 0 ? done : body_framing::length;
+    remaining = length;
+}
+
+void body_framing::start_chunked()
+{
+    current = chunk_size;
+    remaining = 0;
+}
+
+void body_framing::start_until_close()
+{
+    current = until_close;
+    remaining = unlimited;
+}
+
+std::size_t body_framing::consume(const char* begin, const char* end)
+{
+    const char* p = begin;
+    while (p != end)
+    {
+        if (current == length || current == chunk_data)
+        {
+            std::size_t size = std::size_t(std::min<std::uint64_t>(remaining, end - p));
+            p += size;
+            remaining -= size;
+            if (remaining == 0)
+                current = current == length ? done : chunk_size;
+            continue;
+        }
+        if (current == until_close)
+            return end - begin;
+        if (current != chunk_size && current != trailer)
+            break;
+
+        // whole line is needed
+        const char* lf = scan::find(p, end, '\n');
+        if (lf == end)
+            break;
+        const char* line = p;
+        p = lf + 1;
+        if (current == trailer)
+        {
+            if (*line == '\r' || *line == '\n')
+                current = done;
+            continue;
+        }
+
+        std::uint64_t size = 0;
+        const char* digit = line;
+        for (; digit != lf; ++digit)
+        {
+            char c = *digit;
+            int value = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+            if (value < 0)
+                break;
+            size = size * 16 + value;
+            if (size > max_chunk_size)
+                break;
+        }
+        // chunk extensions follow ';', whitespace may precede it
+        if (digit == line || size > max_chunk_size || (digit != lf && *digit != ';' && !is_space(*digit)))
+        {
+            current = error;
+            break;
+        }
+        if (size == 0)
+        {
+            current = trailer;
+        }
+        else
+        {
+            current = chunk_data;
+            remaining = size + 2;
+        }
+    }
+    return p - begin;
+}
+
+std::uint64_t body_framing::spliceable() const
+{
+    switch (current)
+    {
+        case length:
+        case chunk_data:
+        case until_close:
+            return remaining;
+        default:
+            return 0;
+    }
+}
+
+void body_framing::spliced(std::uint64_t size)
+{
+    if (current == until_close)
+        return;
+    remaining -= size;
+    if (remaining == 0)
+        current = current == length ? done : chunk_size;
+}
+
+bool body_framing::complete() const
+{
+    return current == done;
+}
+
+bool body_framing::failed() const
+{
+    return current == error;
+}
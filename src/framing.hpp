@@ -0,0 +1,88 @@
+/*
+ * framing.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef FRAMING_HPP_
+#define FRAMING_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+// Where HTTP/1.x messages end on persistent client connections: fields of
+// header which decide it and body consumed from buffer or spliced by count.
+
+// end of header (after empty line) searching line feeds from from, or 0
+const char* find_header_end(const char* from, const char* end);
+
+// whether start line ends with HTTP/1.0 or starts with it (status line)
+bool is_http10_line(const char* begin, const char* end);
+
+// status code of status line, 0 if line is malformed
+int parse_status(const char* begin, const char* end);
+
+// fields of header which decide where message ends
+struct message_fields
+{
+    message_fields();
+
+    // parses lines from begin (after start line) to the empty line
+    void parse(const char* begin, const char* end);
+
+    // Connection: close / keep-alive
+    bool close;
+    bool keep_alive;
+    bool upgrade;
+    bool expect;
+    // Transfer-Encoding other than identity
+    bool chunked;
+    bool has_length;
+    std::uint64_t length;
+    // Content-Length is malformed or given twice with different values
+    bool bad_length;
+};
+
+// Body of message: consumes bytes it sees in buffer and tells how many of
+// following ones may be spliced without looking at them
+class body_framing
+{
+public:
+    static const std::uint64_t unlimited = ~std::uint64_t(0);
+
+    body_framing();
+
+    void start_length(std::uint64_t length);
+    void start_chunked();
+    // body ends when connection is closed
+    void start_until_close();
+
+    // consumes body bytes at the beginning of [begin, end), returns their number;
+    // chunked body stops before incomplete line
+    std::size_t consume(const char* begin, const char* end);
+    // bytes which may be spliced next, 0 if next bytes must be consumed
+    std::uint64_t spliceable() const;
+    void spliced(std::uint64_t size);
+
+    bool complete() const;
+    // chunk size line is malformed
+    bool failed() const;
+
+private:
+    enum state
+    {
+        length,
+        chunk_size,
+        chunk_data,
+        trailer,
+        until_close,
+        done,
+        error,
+    };
+
+    state current;
+    // bytes left of body or of chunk data with its CRLF
+    std::uint64_t remaining;
+};
+
+#endif /* FRAMING_HPP_ */
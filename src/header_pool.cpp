@@ -0,0 +1,51 @@
+/*
+ * header_pool.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "header_pool.hpp"
+#include "statistics.hpp"
+
+static const statistics::counter header_pool_misses_stat("header_pool_misses");
+static const statistics::counter header_pool_in_use_stat("header_pool_in_use");
+
+header_pool::header_pool(std::size_t buffer_size, std::size_t max_idle)
+    : size(buffer_size)
+    , max_idle(max_idle)
+{
+    idle.reserve(max_idle);
+}
+
+header_pool::~header_pool()
+{
+    for (std::vector<char*>::iterator it = idle.begin(); it != idle.end(); ++it)
+        delete[] *it;
+}
+
+std::size_t header_pool::buffer_size() const
+{
+    return size;
+}
+
+char* header_pool::allocate()
+{
+    statistics::increment(header_pool_in_use_stat);
+    if (idle.empty())
+    {
+        statistics::increment(header_pool_misses_stat);
+        return new char[size];
+    }
+    char* buffer = idle.back();
+    idle.pop_back();
+    return buffer;
+}
+
+void header_pool::deallocate(char* buffer)
+{
+    statistics::decrement(header_pool_in_use_stat);
+    if (idle.size() < max_idle)
+        idle.push_back(buffer);
+    else
+        delete[] buffer;
+}
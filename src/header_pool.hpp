@@ -0,0 +1,37 @@
+/*
+ * header_pool.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef HEADER_POOL_HPP_
+#define HEADER_POOL_HPP_
+
+#include <cstddef>
+#include <vector>
+#include <boost/utility.hpp>
+
+#include "common.hpp"
+
+// Buffers of one proxy for request headers which do not fit into session.
+// All buffers have the same size, the largest header accepted, so header stays
+// contiguous and is sent from where it was received. Freed buffers are kept for
+// reuse up to max_idle. Not thread safe, like session_pool.
+class header_pool : public boost::noncopyable
+{
+public:
+    header_pool(std::size_t buffer_size, std::size_t max_idle);
+    ~header_pool();
+
+    std::size_t buffer_size() const;
+
+    char* allocate();
+    void deallocate(char* buffer);
+
+private:
+    std::size_t size;
+    std::size_t max_idle;
+    std::vector<char*> idle;
+};
+
+#endif /* HEADER_POOL_HPP_ */
@@ -0,0 +1,271 @@
+/*
+ * header_table.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <map>
+#include <algorithm>
+#include <boost/algorithm/string.hpp>
+
+#include "header_table.hpp"
+#include "scan.hpp"
+
+// displacements tried for a bucket before table is built again with next seed
+static const std::uint32_t max_displacement = 1 << 16;
+
+static char lower(char c)
+{
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+// name and value of <name>:<value> rule, value may contain ':'
+static void split_rule(const std::string& rule, std::string& name, std::string& value)
+{
+    std::size_t colon = rule.find(':');
+    name = rule.substr(0, colon);
+    value = colon == std::string::npos ? std::string() : boost::algorithm::trim_left_copy(rule.substr(colon + 1));
+}
+
+struct rule_text
+{
+    rule_text()
+        : drop(false)
+    {
+    }
+
+    rule_text(const std::string& name, const std::string& replacement, bool drop)
+        : name(name)
+        , replacement(replacement)
+        , drop(drop)
+    {
+    }
+
+    std::string name;
+    std::string replacement;
+    bool drop;
+};
+
+struct larger_bucket
+{
+    explicit larger_bucket(const std::vector<std::vector<std::size_t> >& members)
+        : members(members)
+    {
+    }
+
+    bool operator () (std::size_t lhs, std::size_t rhs) const
+    {
+        return members[lhs].size() > members[rhs].size();
+    }
+
+    const std::vector<std::vector<std::size_t> >& members;
+};
+
+header_table::header_table(const std::vector<std::string>& allowed_headers, const std::vector<std::string>& rename_headers,
+        const std::vector<std::string>& set_headers, const std::vector<std::string>& add_headers,
+        bool forwarded_for, const std::string& via)
+    : filter_(!allowed_headers.empty() || !rename_headers.empty())
+    , seed(0)
+{
+    // lowercase name -> rule; later rule of a name wins, set rule overrides
+    // rename rule, allowed header does not override rules
+    typedef std::map<std::string, rule_text> rules_t;
+    rules_t rules;
+    // offsets of added lines in text
+    std::vector<std::pair<std::size_t, std::size_t> > added_lines;
+    for (std::size_t i = 0; i < rename_headers.size(); ++i)
+    {
+        std::vector<std::string> value;
+        // Assume that parameters validation was done before and
+        // we deal with exactly 2 values separated with ':'.
+        boost::split(value, rename_headers[i], boost::is_any_of(":"));
+        rules[boost::algorithm::to_lower_copy(value[0])] = rule_text(value[0], value[1], false);
+    }
+    for (std::size_t i = 0; i < set_headers.size(); ++i)
+    {
+        std::string name, value;
+        split_rule(set_headers[i], name, value);
+        rules[boost::algorithm::to_lower_copy(name)] = rule_text(name, "", true);
+        std::string line = name + ": " + value + "\r\n";
+        added_lines.push_back(std::make_pair(append(line), line.size()));
+    }
+    for (std::size_t i = 0; i < add_headers.size(); ++i)
+    {
+        std::string name, value;
+        split_rule(add_headers[i], name, value);
+        std::string line = name + ": " + value + "\r\n";
+        added_lines.push_back(std::make_pair(append(line), line.size()));
+    }
+    for (std::size_t i = 0; i < allowed_headers.size(); ++i)
+        rules.insert(std::make_pair(boost::algorithm::to_lower_copy(allowed_headers[i]), rule_text(allowed_headers[i], "", false)));
+
+    // Lines of proxies before this one are kept
+    std::size_t forwarded_for_begin = 0;
+    std::size_t forwarded_for_size = 0;
+    if (forwarded_for)
+    {
+        static const std::string prefix = "X-Forwarded-For: ";
+        forwarded_for_begin = append(prefix);
+        forwarded_for_size = prefix.size();
+        if (filter_)
+            rules.insert(std::make_pair("x-forwarded-for", rule_text("X-Forwarded-For", "", false)));
+    }
+    std::size_t via10_begin = 0;
+    std::size_t via11_begin = 0;
+    std::size_t via_size = 0;
+    if (!via.empty())
+    {
+        via10_begin = append("Via: 1.0 " + via + "\r\n");
+        via11_begin = append("Via: 1.1 " + via + "\r\n");
+        via_size = text.size() - via11_begin;
+        if (filter_)
+            rules.insert(std::make_pair("via", rule_text("Via", "", false)));
+    }
+
+    std::vector<rule> offsets;
+    for (rules_t::const_iterator it = rules.begin(); it != rules.end(); ++it)
+    {
+        rule r;
+        r.name_size = it->second.name.size();
+        r.name = append(it->second.name);
+        r.replacement_size = it->second.replacement.size();
+        r.replacement = append(it->second.replacement);
+        r.drop = it->second.drop;
+        offsets.push_back(r);
+    }
+
+    // text does not change anymore
+    for (std::size_t i = 0; i < added_lines.size(); ++i)
+        added_.push_back(at(added_lines[i].first, added_lines[i].second));
+    forwarded_for_ = at(forwarded_for_begin, forwarded_for_size);
+    via10 = at(via10_begin, via_size);
+    via11 = at(via11_begin, via_size);
+
+    while (!build(offsets))
+        ++seed;
+}
+
+bool header_table::build(const std::vector<rule>& rules)
+{
+    std::size_t size = rules.size();
+    std::vector<std::uint64_t> hashes(size);
+    std::vector<std::vector<std::size_t> > members(size);
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        hashes[i] = hash(text.data() + rules[i].name, rules[i].name_size, seed);
+        members[(hashes[i] >> 32) % size].push_back(i);
+    }
+
+    // buckets with more names are placed first, while there are more free slots
+    std::vector<std::size_t> order(size);
+    for (std::size_t i = 0; i < size; ++i)
+        order[i] = i;
+    std::sort(order.begin(), order.end(), larger_bucket(members));
+
+    std::vector<bool> taken(size);
+    std::vector<std::size_t> slots;
+    entries.assign(size, entry());
+    displacements.assign(size, 0);
+    for (std::size_t i = 0; i < size && !members[order[i]].empty(); ++i)
+    {
+        const std::vector<std::size_t>& bucket = members[order[i]];
+        std::uint32_t displacement = 0;
+        for (;; ++displacement)
+        {
+            if (displacement == max_displacement)
+                return false;
+            slots.clear();
+            for (std::size_t j = 0; j < bucket.size(); ++j)
+            {
+                std::size_t s = slot(hashes[bucket[j]], displacement, size);
+                if (taken[s] || std::find(slots.begin(), slots.end(), s) != slots.end())
+                    break;
+                slots.push_back(s);
+            }
+            if (slots.size() == bucket.size())
+                break;
+        }
+
+        displacements[order[i]] = displacement;
+        for (std::size_t j = 0; j < bucket.size(); ++j)
+        {
+            const rule& r = rules[bucket[j]];
+            taken[slots[j]] = true;
+            entries[slots[j]].name = at(r.name, r.name_size);
+            entries[slots[j]].replacement = at(r.replacement, r.replacement_size);
+            entries[slots[j]].drop = r.drop;
+        }
+    }
+    return true;
+}
+
+std::size_t header_table::append(const std::string& s)
+{
+    std::size_t offset = text.size();
+    text += s;
+    return offset;
+}
+
+lstring header_table::at(std::size_t offset, std::size_t size) const
+{
+    return lstring(text.data() + offset, text.data() + offset + size);
+}
+
+bool header_table::empty() const
+{
+    return entries.empty() && added_.empty() && forwarded_for_.empty() && via10.empty();
+}
+
+bool header_table::filter() const
+{
+    return filter_;
+}
+
+const header_table::entry* header_table::find(const char* begin, const char* end) const
+{
+    if (entries.empty())
+        return 0;
+    const char* colon = scan::find(begin, end, ':');
+    if (colon == end)
+        return 0;
+
+    std::size_t size = colon - begin;
+    std::uint64_t h = hash(begin, size, seed);
+    const entry& e = entries[slot(h, displacements[(h >> 32) % displacements.size()], entries.size())];
+    if (e.name.size() != size || scan::mismatch_nocase(e.name.begin, begin, size) != size)
+        return 0;
+    return &e;
+}
+
+const std::vector<lstring>& header_table::added() const
+{
+    return added_;
+}
+
+const lstring& header_table::forwarded_for() const
+{
+    return forwarded_for_;
+}
+
+const lstring& header_table::via(bool http10) const
+{
+    return http10 ? via10 : via11;
+}
+
+// FNV-1a of lowercase name
+std::uint64_t header_table::hash(const char* name, std::size_t size, std::uint32_t seed)
+{
+    std::uint64_t hash = 14695981039346656037ULL ^ seed;
+    for (std::size_t i = 0; i < size; ++i)
+        hash = (hash ^ static_cast<unsigned char>(lower(name[i]))) * 1099511628211ULL;
+    return hash;
+}
+
+std::size_t header_table::slot(std::uint64_t hash, std::uint32_t displacement, std::size_t size)
+{
+    std::uint32_t x = std::uint32_t(hash) ^ displacement * 0x9e3779b9u;
+    x ^= x >> 16;
+    x *= 0x85ebca6bu;
+    x ^= x >> 13;
+    return x % size;
+}
@@ -0,0 +1,88 @@
+/*
+ * header_table.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef HEADER_TABLE_HPP_
+#define HEADER_TABLE_HPP_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <boost/utility.hpp>
+
+#include "headers.hpp"
+
+// Request header rules: allowed, renamed and dropped headers looked up by
+// header name up to ':' ignoring case, and header lines added to requests.
+// Table is built at startup with minimal perfect hash (hash and displace), so
+// lookup hashes the name once and compares it with a single entry. Names
+// containing ':' never match. Added header lines are preformatted, so session
+// sends them from here without copying.
+class header_table : public boost::noncopyable
+{
+public:
+    struct entry
+    {
+        lstring name;
+        // empty if header is passed as is
+        lstring replacement;
+        // header is removed from request, set rule adds it with new value
+        bool drop;
+    };
+
+    // rename rules are <original name>:<new name>, renamed headers are allowed too;
+    // set rules are <name>:<value>, header of request is replaced or added;
+    // added headers are <name>:<value> and are added even if request has one;
+    // forwarded_for adds X-Forwarded-For with client address;
+    // via adds Via with this pseudonym unless empty
+    header_table(const std::vector<std::string>& allowed_headers, const std::vector<std::string>& rename_headers,
+            const std::vector<std::string>& set_headers, const std::vector<std::string>& add_headers,
+            bool forwarded_for, const std::string& via);
+
+    // headers are passed as is
+    bool empty() const;
+    // headers missing from table are removed
+    bool filter() const;
+    // entry of header line or 0 if header is not in table
+    const entry* find(const char* begin, const char* end) const;
+    // lines added after headers of request
+    const std::vector<lstring>& added() const;
+    // "X-Forwarded-For: " to be followed by client address or empty
+    const lstring& forwarded_for() const;
+    // Via line for HTTP/1.0 or HTTP/1.1 request or empty
+    const lstring& via(bool http10) const;
+
+private:
+    struct rule
+    {
+        std::size_t name;
+        std::size_t name_size;
+        std::size_t replacement;
+        std::size_t replacement_size;
+        bool drop;
+    };
+
+    static std::uint64_t hash(const char* name, std::size_t size, std::uint32_t seed);
+    static std::size_t slot(std::uint64_t hash, std::uint32_t displacement, std::size_t size);
+    bool build(const std::vector<rule>& rules);
+    // appends text, returns its offset
+    std::size_t append(const std::string& s);
+    lstring at(std::size_t offset, std::size_t size) const;
+
+    // names, new names and added lines
+    std::string text;
+    bool filter_;
+    std::uint32_t seed;
+    // by slot
+    std::vector<entry> entries;
+    // by bucket
+    std::vector<std::uint32_t> displacements;
+    std::vector<lstring> added_;
+    lstring forwarded_for_;
+    lstring via10;
+    lstring via11;
+};
+
+#endif /* HEADER_TABLE_HPP_ */
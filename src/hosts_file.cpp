@@ -0,0 +1,162 @@
+/*
+ * hosts_file.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <errno.h>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <boost/algorithm/string/case_conv.hpp>
+
+#include "hosts_file.hpp"
+#include "dns_cache.hpp"
+#include "statistics.hpp"
+
+logger hosts_file::log = logger(keywords::channel = "hosts_file");
+hosts_file* hosts_file::instance_;
+
+static const statistics::counter hosts_reloads_stat("hosts_reloads");
+static const statistics::counter hosts_reloads_failed_stat("hosts_reloads_failed");
+
+static char lower(char c)
+{
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+// FNV-1a of lowercase name
+static std::uint64_t name_hash(const char* name, std::size_t size)
+{
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (std::size_t i = 0; i < size; ++i)
+        hash = (hash ^ static_cast<unsigned char>(lower(name[i]))) * 1099511628211ULL;
+    return hash;
+}
+
+hosts_table::hosts_table(const entries_t& entries)
+    : count(entries.size())
+{
+    // at most half full, so probes stay short
+    std::size_t capacity = 16;
+    while (capacity < entries.size() * 2)
+        capacity *= 2;
+    slot empty = slot();
+    slots.assign(capacity, empty);
+    mask = capacity - 1;
+
+    for (entries_t::const_iterator it = entries.begin(); it != entries.end(); ++it)
+    {
+        slot s;
+        s.hash = name_hash(it->first.data(), it->first.size());
+        s.name_offset = names.size();
+        s.name_size = it->first.size();
+        s.address_offset = addresses.size();
+        s.address_count = it->second.size();
+        names.insert(names.end(), it->first.begin(), it->first.end());
+        addresses.insert(addresses.end(), it->second.begin(), it->second.end());
+
+        std::size_t pos = s.hash & mask;
+        while (slots[pos].name_size != 0)
+            pos = (pos + 1) & mask;
+        slots[pos] = s;
+    }
+}
+
+hosts_table::range hosts_table::find(const char* name) const
+{
+    std::size_t size = std::strlen(name);
+    std::uint64_t hash = name_hash(name, size);
+    for (std::size_t pos = hash & mask; slots[pos].name_size != 0; pos = (pos + 1) & mask)
+    {
+        const slot& s = slots[pos];
+        if (s.hash != hash || s.name_size != size)
+            continue;
+        const char* candidate = &names[s.name_offset];
+        std::size_t i = 0;
+        while (i < size && lower(name[i]) == candidate[i])
+            ++i;
+        if (i == size)
+            return range(&addresses[s.address_offset], &addresses[s.address_offset] + s.address_count);
+    }
+    return range(0, 0);
+}
+
+std::size_t hosts_table::size() const
+{
+    return count;
+}
+
+hosts_file::hosts_file(const std::string& path)
+    : path(path)
+    , current(load())
+{
+    instance_ = this;
+}
+
+hosts_file* hosts_file::instance()
+{
+    return instance_;
+}
+
+std::shared_ptr<const hosts_table> hosts_file::table() const
+{
+    return std::atomic_load(&current);
+}
+
+void hosts_file::reload()
+{
+    try
+    {
+        std::atomic_store(&current, load());
+        statistics::increment(hosts_reloads_stat);
+    }
+    catch (const std::exception& e)
+    {
+        BOOST_LOG_SEV(log, severity_level::error) << e.what();
+        statistics::increment(hosts_reloads_failed_stat);
+    }
+}
+
+std::shared_ptr<const hosts_table> hosts_file::load() const
+{
+    std::ifstream file(path.c_str());
+    if (!file)
+        throw system_error(error_code(errno, boost::system::get_system_category()), path);
+
+    hosts_table::entries_t entries;
+    std::string line;
+    for (std::size_t line_number = 1; std::getline(file, line); ++line_number)
+    {
+        line.erase(std::find(line.begin(), line.end(), '#'), line.end());
+        std::istringstream fields(line);
+        std::string address_string;
+        if (!(fields >> address_string))
+            continue;
+
+        error_code ec;
+        ip::address address = ip::address::from_string(address_string, ec);
+        if (ec)
+        {
+            BOOST_LOG_SEV(log, severity_level::warning) << path << ":" << line_number << ": bad address " << address_string;
+            continue;
+        }
+
+        std::string name;
+        while (fields >> name)
+        {
+            boost::algorithm::to_lower(name);
+            std::vector<ip::address>& name_addresses = entries[name];
+            // session connects to max_addresses at most
+            if (name_addresses.size() < dns_cache::max_addresses)
+                name_addresses.push_back(address);
+        }
+    }
+    if (file.bad())
+        throw system_error(error_code(errno, boost::system::get_system_category()), path);
+
+    std::shared_ptr<const hosts_table> table(new hosts_table(entries));
+    BOOST_LOG_SEV(log, severity_level::info) << path << ": " << table->size() << " names";
+    return table;
+}
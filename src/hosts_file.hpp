@@ -0,0 +1,79 @@
+/*
+ * hosts_file.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef HOSTS_FILE_HPP_
+#define HOSTS_FILE_HPP_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/utility.hpp>
+#include <boost/asio/ip/address.hpp>
+
+#include "common.hpp"
+
+// Immutable open addressing table of host names and their addresses.
+// Lookup does not allocate.
+class hosts_table : public boost::noncopyable
+{
+public:
+    typedef std::pair<const ip::address*, const ip::address*> range;
+    typedef std::map<std::string, std::vector<ip::address> > entries_t;
+
+    // names of entries are lowercase
+    explicit hosts_table(const entries_t& entries);
+
+    // empty range if name is not in table, name is compared case insensitively
+    range find(const char* name) const;
+    std::size_t size() const;
+
+private:
+    struct slot
+    {
+        std::uint64_t hash;
+        std::uint32_t name_offset;
+        // 0 if slot is empty
+        std::uint32_t name_size;
+        std::uint32_t address_offset;
+        std::uint32_t address_count;
+    };
+
+    std::vector<slot> slots;
+    std::size_t mask;
+    std::size_t count;
+    std::vector<char> names;
+    std::vector<ip::address> addresses;
+};
+
+// Process-wide table loaded from hosts file (address followed by names, '#'
+// starts a comment). Reload builds a new table aside and swaps it in, a session
+// keeps the table it got until it is done with it.
+class hosts_file : public boost::noncopyable
+{
+public:
+    // throws if file can not be read
+    explicit hosts_file(const std::string& path);
+
+    // 0 if hosts file is not used
+    static hosts_file* instance();
+
+    std::shared_ptr<const hosts_table> table() const;
+    // current table stays if file can not be read
+    void reload();
+
+private:
+    std::shared_ptr<const hosts_table> load() const;
+
+    std::string path;
+    std::shared_ptr<const hosts_table> current;
+
+    static hosts_file* instance_;
+    static logger log;
+};
+
+#endif /* HOSTS_FILE_HPP_ */
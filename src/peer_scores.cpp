@@ -0,0 +1,198 @@
+/*
+ * peer_scores.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <cmath>
+#include <algorithm>
+
+#include "peer_scores.hpp"
+#include "statistics.hpp"
+
+logger peer_scores::log = logger(keywords::channel = "peer_scores");
+peer_scores* peer_scores::instance_;
+
+static const statistics::counter peer_scores_size_stat("peer_scores_size");
+static const statistics::counter peer_scores_evictions_stat("peer_scores_evictions");
+static const statistics::counter peer_scores_reordered_stat("peer_scores_reordered");
+
+// weight of the newest sample in moving averages
+static const double sample_weight = 0.2;
+// failure rate halves every failure_half_life seconds address is not tried
+static const double failure_half_life = 60;
+
+peer_scores::peer_scores(std::size_t capacity, const time_duration& failure_penalty)
+    : capacity(capacity)
+    , hand(0)
+    , failure_penalty(failure_penalty.total_microseconds() * 1e-6)
+{
+    if (capacity == 0)
+        return;
+
+    instance_ = this;
+    entries.reserve(capacity);
+    index.reserve(capacity);
+}
+
+peer_scores* peer_scores::instance()
+{
+    return instance_;
+}
+
+peer_scores::key_t peer_scores::make_key(const ip::address& address)
+{
+    key_t key;
+    if (address.is_v6())
+    {
+        ip::address_v6::bytes_type bytes = address.to_v6().to_bytes();
+        std::copy(bytes.begin(), bytes.end(), key.begin());
+    }
+    else
+    {
+        // IPv4-mapped form
+        ip::address_v4::bytes_type bytes = address.to_v4().to_bytes();
+        std::fill(key.begin(), key.end() - 6, 0);
+        key[10] = key[11] = 0xff;
+        std::copy(bytes.begin(), bytes.end(), key.end() - 4);
+    }
+    return key;
+}
+
+void peer_scores::connected(const ip::address& address, double latency)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entry& e = get(address);
+    std::time_t now = std::time(0);
+    if (e.attempts != 0)
+        e.failures *= std::exp2(-(now - e.updated) / failure_half_life) * (1 - sample_weight);
+    e.latency = e.latency < 0 ? latency : e.latency + sample_weight * (latency - e.latency);
+    e.updated = now;
+    e.referenced = true;
+    ++e.attempts;
+}
+
+void peer_scores::failed(const ip::address& address)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    entry& e = get(address);
+    std::time_t now = std::time(0);
+    if (e.attempts == 0)
+        e.failures = 1;
+    else
+        e.failures = e.failures * std::exp2(-(now - e.updated) / failure_half_life) * (1 - sample_weight) + sample_weight;
+    e.updated = now;
+    e.referenced = true;
+    ++e.attempts;
+}
+
+void peer_scores::order(ip::address* begin, ip::address* end)
+{
+    std::size_t size = std::min<std::size_t>(end - begin, max_ordered);
+    if (size < 2)
+        return;
+
+    std::pair<double, std::size_t> scores[max_ordered];
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::time_t now = std::time(0);
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            index_t::const_iterator it = index.find(make_key(begin[i]));
+            scores[i].first = it == index.end() ? 0 : score(entries[it->second], now);
+            scores[i].second = i;
+        }
+    }
+
+    // pairs with equal scores keep their order by index
+    std::sort(scores, scores + size);
+    bool reordered = false;
+    ip::address sorted[max_ordered];
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        sorted[i] = begin[scores[i].second];
+        reordered |= scores[i].second != i;
+    }
+    if (!reordered)
+        return;
+
+    std::copy(sorted, sorted + size, begin);
+    statistics::increment(peer_scores_reordered_stat);
+}
+
+void peer_scores::dump(std::ostream& os, std::size_t count)
+{
+    std::vector<std::pair<unsigned long, std::size_t> > top;
+    std::lock_guard<std::mutex> lock(mutex);
+    top.reserve(entries.size());
+    for (std::size_t i = 0; i < entries.size(); ++i)
+        top.push_back(std::make_pair(entries[i].attempts, i));
+    count = std::min(count, top.size());
+    std::partial_sort(top.begin(), top.begin() + count, top.end(), std::greater<std::pair<unsigned long, std::size_t> >());
+
+    std::time_t now = std::time(0);
+    os << "address\tattempts\tlatency\tfailures\tscore\n";
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        const entry& e = entries[top[i].second];
+        os << e.address << "\t" << e.attempts << "\t" << std::max(e.latency, 0.0) << "\t"
+                << e.failures * std::exp2(-(now - e.updated) / failure_half_life) << "\t" << score(e, now) << "\n";
+    }
+}
+
+// called with mutex locked, finds or creates entry of address
+peer_scores::entry& peer_scores::get(const ip::address& address)
+{
+    key_t key = make_key(address);
+    std::pair<index_t::iterator, bool> inserted = index.insert(index_t::value_type(key, entries.size()));
+    if (!inserted.second)
+        return entries[inserted.first->second];
+
+    if (entries.size() < capacity)
+    {
+        entries.push_back(entry());
+        statistics::increment(peer_scores_size_stat);
+    }
+    else
+    {
+        inserted.first->second = evict();
+    }
+
+    entry& e = entries[inserted.first->second];
+    e.key = key;
+    e.address = address;
+    e.latency = -1;
+    e.failures = 0;
+    e.updated = std::time(0);
+    e.attempts = 0;
+    e.referenced = false;
+    return e;
+}
+
+// expected connect time in seconds
+double peer_scores::score(const entry& e, std::time_t now) const
+{
+    double failures = e.failures * std::exp2(-(now - e.updated) / failure_half_life);
+    return std::max(e.latency, 0.0) + failures * failure_penalty;
+}
+
+// called with mutex locked, returns entry to be reused
+std::size_t peer_scores::evict()
+{
+    for (;; hand = (hand + 1) % entries.size())
+    {
+        entry& e = entries[hand];
+        if (e.referenced)
+        {
+            e.referenced = false;
+            continue;
+        }
+
+        TRACE() << e.address;
+        statistics::increment(peer_scores_evictions_stat);
+        index.erase(e.key);
+        std::size_t victim = hand;
+        hand = (hand + 1) % entries.size();
+        return victim;
+    }
+}
@@ -0,0 +1,82 @@
+/*
+ * peer_scores.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef PEER_SCORES_HPP_
+#define PEER_SCORES_HPP_
+
+#include <ctime>
+#include <ostream>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+#include <boost/array.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/utility.hpp>
+#include <boost/asio/ip/address.hpp>
+
+#include "common.hpp"
+
+// Process-wide table of connect quality of peer addresses shared by sessions of
+// all workers. Every finished connection attempt updates exponentially weighted
+// moving averages of connect latency and failure rate of its address, failure
+// rate fades while address is not tried. Addresses of a peer are tried in order
+// of expected connect time, failure costs failure_penalty. Number of addresses
+// is bounded, CLOCK policy evicts addresses which were not connected recently.
+class peer_scores : public boost::noncopyable
+{
+public:
+    // addresses past max_ordered keep their places
+    static const std::size_t max_ordered = 16;
+
+    peer_scores(std::size_t capacity, const time_duration& failure_penalty);
+
+    // 0 if scoring is disabled
+    static peer_scores* instance();
+
+    void connected(const ip::address& address, double latency);
+    void failed(const ip::address& address);
+
+    // stable sorts addresses by expected connect time, addresses without
+    // score are tried first to get one
+    void order(ip::address* begin, ip::address* end);
+
+    // writes count most used addresses with their scores
+    void dump(std::ostream& os, std::size_t count);
+
+private:
+    typedef boost::array<unsigned char, 16> key_t;
+
+    struct entry
+    {
+        key_t key;
+        ip::address address;
+        double latency;         // seconds
+        double failures;        // fraction of failed attempts
+        std::time_t updated;
+        unsigned long attempts;
+        bool referenced;
+    };
+
+    typedef std::unordered_map<key_t, std::size_t, boost::hash<key_t> > index_t;
+
+    static key_t make_key(const ip::address& address);
+    // called with mutex locked
+    entry& get(const ip::address& address);
+    double score(const entry& e, std::time_t now) const;
+    std::size_t evict();
+
+    std::mutex mutex;
+    std::vector<entry> entries;
+    index_t index;
+    std::size_t capacity;
+    std::size_t hand;
+    double failure_penalty;
+
+    static peer_scores* instance_;
+    static logger log;
+};
+
+#endif /* PEER_SCORES_HPP_ */
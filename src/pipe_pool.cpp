@@ -0,0 +1,125 @@
+/*
+ * pipe_pool.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "pipe_pool.hpp"
+#include "statistics.hpp"
+
+logger pipe_pool::log = logger(keywords::channel = "pipe_pool");
+pipe_pool* pipe_pool::instance_;
+
+static const statistics::counter pipe_pool_hits_stat("pipe_pool_hits");
+static const statistics::counter pipe_pool_misses_stat("pipe_pool_misses");
+static const statistics::counter pipe_pool_in_use_stat("pipe_pool_in_use");
+static const statistics::counter pipe_pool_idle_stat("pipe_pool_idle");
+
+pipe_pool::pipe_pool(std::size_t min_size, std::size_t max_size)
+    : max_size(std::max(min_size, max_size))
+{
+    instance_ = this;
+    idle.reserve(this->max_size);
+    for (std::size_t i = 0; i < min_size; ++i)
+    {
+        int pipe[2];
+        error_code ec;
+        create(pipe, ec);
+        if (ec)
+            throw system_error(ec, "pipe_pool: pipe2 failed");
+        pipe_fds fds = { pipe[0], pipe[1] };
+        idle.push_back(fds);
+    }
+    statistics::increment(pipe_pool_idle_stat, long(idle.size()));
+}
+
+pipe_pool::~pipe_pool()
+{
+    for (std::vector<pipe_fds>::iterator it = idle.begin(); it != idle.end(); ++it)
+    {
+        close(it->read);
+        close(it->write);
+    }
+}
+
+pipe_pool& pipe_pool::instance()
+{
+    return *instance_;
+}
+
+void pipe_pool::acquire(int pipe[2], error_code& ec)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!idle.empty())
+        {
+            pipe[0] = idle.back().read;
+            pipe[1] = idle.back().write;
+            idle.pop_back();
+        }
+        else
+        {
+            pipe[0] = pipe[1] = -1;
+        }
+    }
+
+    if (pipe[0] != -1)
+    {
+        statistics::increment(pipe_pool_hits_stat);
+        statistics::decrement(pipe_pool_idle_stat);
+    }
+    else
+    {
+        statistics::increment(pipe_pool_misses_stat);
+        create(pipe, ec);
+        if (ec)
+            return;
+    }
+    statistics::increment(pipe_pool_in_use_stat);
+}
+
+void pipe_pool::release(int pipe[2])
+{
+    statistics::decrement(pipe_pool_in_use_stat);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (idle.size() < max_size)
+        {
+            pipe_fds fds = { pipe[0], pipe[1] };
+            idle.push_back(fds);
+            pipe[0] = pipe[1] = -1;
+        }
+    }
+
+    if (pipe[0] == -1)
+    {
+        statistics::increment(pipe_pool_idle_stat);
+        return;
+    }
+
+    close(pipe[0]);
+    close(pipe[1]);
+    pipe[0] = pipe[1] = -1;
+}
+
+void pipe_pool::discard(int pipe[2])
+{
+    statistics::decrement(pipe_pool_in_use_stat);
+    close(pipe[0]);
+    close(pipe[1]);
+    pipe[0] = pipe[1] = -1;
+}
+
+void pipe_pool::create(int pipe[2], error_code& ec)
+{
+    if (pipe2(pipe, O_NONBLOCK) == -1)
+    {
+        ec = error_code(errno, boost::system::get_system_category());
+        BOOST_LOG_SEV(log, severity_level::error) << system_error(ec, "pipe2").what();
+        pipe[0] = pipe[1] = -1;
+    }
+}
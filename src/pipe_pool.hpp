@@ -0,0 +1,51 @@
+/*
+ * pipe_pool.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef PIPE_POOL_HPP_
+#define PIPE_POOL_HPP_
+
+#include <vector>
+#include <mutex>
+#include <boost/utility.hpp>
+
+#include "common.hpp"
+
+// Process-wide pool of non-blocking pipes used by channels for splicing.
+// Channel borrows a pipe only when data starts flowing and gives it back
+// as soon as the pipe is drained, so idle and failed sessions own no pipes.
+class pipe_pool : public boost::noncopyable
+{
+public:
+    // min_size pipes are created at startup, at most max_size idle pipes are kept
+    pipe_pool(std::size_t min_size, std::size_t max_size);
+    ~pipe_pool();
+
+    static pipe_pool& instance();
+
+    void acquire(int pipe[2], error_code& ec);
+    // pipe must be empty
+    void release(int pipe[2]);
+    // closes pipe which still holds data
+    void discard(int pipe[2]);
+
+private:
+    void create(int pipe[2], error_code& ec);
+
+    struct pipe_fds
+    {
+        int read;
+        int write;
+    };
+
+    std::mutex mutex;
+    std::vector<pipe_fds> idle;
+    std::size_t max_size;
+
+    static pipe_pool* instance_;
+    static logger log;
+};
+
+#endif /* PIPE_POOL_HPP_ */
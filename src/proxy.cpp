@@ -5,12 +5,15 @@
  *      Author: nbryskin
  */
 
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/socket.h>
 #include <iostream>
 #include <fstream>
 #include <functional>
 #include <boost/bind.hpp>
 #include <boost/format.hpp>
-#include <boost/algorithm/string.hpp>
 
 #include "proxy.hpp"
 #include "statistics.hpp"
@@ -18,60 +21,60 @@
 
 logger proxy::log = logger(keywords::channel = "proxy");
 typedef std::ios ios;
+typedef asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port_option;
+// one revolution covers timeouts up to 1024 * timer_resolution
+const std::size_t wheel_slots = 1024;
+// sessions allocated at once when session pool runs out of free slots
+const std::size_t session_slab_size = 64;
+// freed header buffers kept for reuse
+const std::size_t idle_header_buffers = 16;
 
-bool session_less(const session& lhs, const session& rhs)
+// accept backoff doubles on every consecutive error, timing wheel rounds it up to its resolution
+const time_duration min_accept_backoff = boost::posix_time::milliseconds(10);
+const time_duration max_accept_backoff = boost::posix_time::seconds(1);
+
+static const statistics::counter drained_accepts_stat("drained_accepts");
+static const statistics::counter accept_aborted_stat("accept_aborted");
+static const statistics::counter accept_no_fds_stat("accept_no_fds");
+static const statistics::counter accept_no_memory_stat("accept_no_memory");
+static const statistics::counter accept_errors_stat("accept_errors");
+static const statistics::counter accept_shed_stat("accept_shed");
+static const statistics::counter accept_backoffs_stat("accept_backoffs");
+
+struct delete_disposer
 {
-    return lhs.get_id() < rhs.get_id();
-}
+    void operator () (session* s) const
+    {
+        delete s;
+    }
+};
 
 proxy::proxy(asio::io_service& io, std::vector<ip::tcp::endpoint> inbound, const ip::tcp::endpoint& outbound_http,
-             const ip::udp::endpoint& outbound_ns, const ip::udp::endpoint& name_server,
-             const time_duration& receive_timeout, const time_duration& connect_timeout,
-             const time_duration& resolve_timeout, const std::vector<std::string>& allowed_headers,
+             const ip::tcp::endpoint& outbound_http6, const ip::udp::endpoint& outbound_ns, const std::vector<ip::udp::endpoint>& name_servers,
+             const time_duration& receive_timeout, const time_duration& connect_timeout, const time_duration& connect_attempt_delay,
+             const time_duration& resolve_timeout, const time_duration& timer_resolution, long splice_budget, const std::vector<std::string>& allowed_headers,
              const std::vector<std::string>& rename_headers,
-             const std::string error_pages_dir, bool use_unbound_resolve)
-    : resolver_(io, outbound_ns, name_server, use_unbound_resolve)
+             const std::vector<std::string>& set_headers, const std::vector<std::string>& add_headers, bool forwarded_for, const std::string& via,
+             const std::string error_pages_dir, resolver::library resolve_library, const stub_resolver::config& stub_config, bool resolve_ipv6, bool reuse_port, unsigned uring_entries,
+             std::size_t session_pool_prealloc, unsigned accept_batch, unsigned accepts_per_listener, std::size_t max_header_size,
+             bool client_keep_alive)
+    : wheel(io, timer_resolution, wheel_slots)
+    , reserve_fd(-1)
+    , pool(sizeof(session), session_slab_size, session_pool_prealloc)
+    , header_buffers(max_header_size, idle_header_buffers)
+    , resolver_(io, outbound_ns, name_servers, resolve_library, stub_config, resolve_ipv6)
     , outbound_http(outbound_http)
+    , outbound_http6(outbound_http6)
     , receive_timeout(receive_timeout)
     , connect_timeout(connect_timeout)
+    , connect_attempt_delay(connect_attempt_delay)
     , resolve_timeout(resolve_timeout)
-    , sessions(std::ptr_fun(session_less))
+    , splice_budget(splice_budget)
+    , accept_batch(accept_batch)
+    , accepts_per_listener(accepts_per_listener)
+    , client_keep_alive(client_keep_alive)
+    , allowed_headers(allowed_headers, rename_headers, set_headers, add_headers, forwarded_for, via)
 {
-    headers.push_back("");
-    lstring empty(headers.back().c_str());
-
-    // Construct header mapping, every header which is mapped implies that
-    // it is allowed (and the same map can be used for mapped and allowed
-    // headers).
-    for (size_t i = 0; i < rename_headers.size(); i++)
-    {
-        std::vector<std::string> value;
-
-        // Assume that parameters validation was done before and
-        // we deal with exactly 2 values separated with ':'.
-        boost::split(value, rename_headers[i], boost::is_any_of(":"));
-
-        headers.push_back(value[0]);
-        lstring original(headers.back().c_str());
-
-        headers.push_back(value[1]);
-        lstring replacement(headers.back().c_str());
-
-        this->allowed_headers[original] = replacement;
-    }
-
-    // For allowed (not mapped) headers there is no replacement
-    // value. Empty string is used to indicate the case.
-    for (size_t i = 0; i < allowed_headers.size(); i++)
-    {
-        headers.push_back(allowed_headers[i]);
-        lstring header(headers.back().c_str());
-        if (this->allowed_headers.find(header) == this->allowed_headers.end())
-        {
-            this->allowed_headers[header] = empty;
-        }
-    }
-
     for (int httpec = HTTP_BEGIN; httpec < HTTP_END; ++httpec)
     {
         std::ifstream page_file((boost::format("%1%/%2%.http") % error_pages_dir % httpec).str(), ios::in|ios::binary|ios::ate);
@@ -83,19 +86,72 @@ proxy::proxy(asio::io_service& io, std::vector<ip::tcp::endpoint> inbound, const
         page_file.read(&*(error_pages[httpec - HTTP_BEGIN].begin()), size);
     }
 
+    if (uring_entries > 0)
+    {
+#ifdef HAVE_IO_URING
+        if (uring::supported())
+            ring.reset(new uring(io, uring_entries));
+        else
+            BOOST_LOG_SEV(log, severity_level::warning) << "io_uring is not supported by kernel, using asio engine";
+#else
+        BOOST_LOG_SEV(log, severity_level::warning) << "built without io_uring support, using asio engine";
+#endif
+    }
+
     assert(!inbound.empty());
 
     for (auto it = inbound.begin(); it != inbound.end(); ++it)
     {
-        this->acceptors.push_back(boost::shared_ptr<ip::tcp::acceptor>(new ip::tcp::acceptor(io, *it)));
+        // with several workers every one of them binds its own acceptor to the same
+        // address and kernel balances incoming connections between them
+        listeners.push_back(new listener(io, *it));
+        ip::tcp::acceptor& acceptor = listeners.back().acceptor;
+        acceptor.open(it->protocol());
+        acceptor.set_option(ip::tcp::acceptor::reuse_address(true));
+        if (reuse_port)
+            acceptor.set_option(reuse_port_option(true));
+        acceptor.bind(*it);
+        acceptor.listen();
+        // backlog is drained and shed with accept4() until it would block
+        asio::socket_base::non_blocking_io non_blocking(true);
+        acceptor.io_control(non_blocking);
+        listeners.back().backoff_timer.set_handler(boost::bind(&proxy::resume_accept, this, boost::ref(listeners.back())));
     }
+
+    open_reserve_fd();
+}
+
+proxy::~proxy()
+{
+    sessions.clear_and_dispose(delete_disposer());
+    if (reserve_fd != -1)
+        close(reserve_fd);
+}
+
+proxy::listener::listener(asio::io_service& io, const ip::tcp::endpoint& endpoint)
+    : acceptor(io)
+    , protocol(endpoint.protocol())
+    , suspended_accepts(0)
+{
 }
 
 // called by main (parent)
 void proxy::start()
 {
-    for (auto it = this->acceptors.begin(); it != acceptors.end(); ++it)
-        start_accept(**it);
+    for (boost::ptr_vector<listener>::iterator it = listeners.begin(); it != listeners.end(); ++it)
+    {
+#ifdef HAVE_IO_URING
+        if (ring)
+        {
+            it->ring_op.set_handler(boost::bind(&proxy::handle_ring_accept, this, _1, _2, boost::ref(*it)));
+            start_ring_accept(*it);
+            continue;
+        }
+#endif
+        for (unsigned i = 0; i < accepts_per_listener; ++i)
+            start_accept(*it);
+    }
+    wheel.start();
     resolver_.start();
     TRACE() << "started";
 }
@@ -110,39 +166,194 @@ resolver& proxy::get_resolver()
 void proxy::finished_session(session* session, const boost::system::error_code& ec)
 {
     TRACE_ERROR(ec) << session->get_id();
-    std::size_t c = sessions.erase(*session);
-    if (c != 1)
-        TRACE() << "erased " << c << " items. total " << sessions.size() << " items";
-    assert(c == 1);
+    sessions.erase_and_dispose(sessions.iterator_to(*session), delete_disposer());
 }
 
-void proxy::start_accept(ip::tcp::acceptor& acceptor)
+void proxy::start_accept(listener& l)
 {
-    std::unique_ptr<session> new_sess(new session(acceptor.io_service(), *this));
-    acceptor.async_accept(new_sess->socket(), boost::bind(&proxy::handle_accept, this, placeholders::error(), new_sess.get(), boost::ref(acceptor)));
+    std::unique_ptr<session> new_sess(new (pool) session(l.acceptor.io_service(), *this));
+    l.acceptor.async_accept(new_sess->socket(), boost::bind(&proxy::handle_accept, this, placeholders::error(), new_sess.get(), boost::ref(l)));
     new_sess.release();
 }
 
-void proxy::handle_accept(const boost::system::error_code& ec, session* new_session, ip::tcp::acceptor& acceptor)
+void proxy::handle_accept(const boost::system::error_code& ec, session* new_session, listener& l)
 {
     std::unique_ptr<session> session_ptr(new_session);
     TRACE_ERROR(ec);
     if (ec)
+    {
+        if (handle_accept_error(l, ec))
+            start_accept(l);
         return;
+    }
 
-    start_accept(acceptor);
+    l.backoff = time_duration();
     start_session(session_ptr.get());
     session_ptr.release();
+    if (drain_accept(l))
+        start_accept(l);
+}
+
+bool proxy::drain_accept(listener& l)
+{
+    for (unsigned i = 1; i < accept_batch; ++i)
+    {
+        int fd = accept4(l.acceptor.native(), 0, 0, SOCK_CLOEXEC);
+        if (fd == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (!handle_accept_error(l, error_code(errno, boost::system::get_system_category())))
+                return false;
+            continue;
+        }
+        statistics::increment(drained_accepts_stat);
+        start_session(l, fd);
+    }
+    return true;
+}
+
+bool proxy::handle_accept_error(listener& l, const error_code& ec)
+{
+    // listener is closed
+    if (ec == asio::error::operation_aborted || ec == asio::error::bad_descriptor)
+        return false;
+
+    switch (ec.value())
+    {
+    // client has gone before it was accepted, next one may be fine
+    case ECONNABORTED:
+    case EPROTO:
+    case EPERM:
+    case EINTR:
+    case EAGAIN:
+        statistics::increment(accept_aborted_stat);
+        return true;
+
+    case EMFILE:
+    case ENFILE:
+        statistics::increment(accept_no_fds_stat);
+        BOOST_LOG_SEV(log, severity_level::error) << system_error(ec, "accept").what();
+        shed_accept(l);
+        break;
+
+    case ENOBUFS:
+    case ENOMEM:
+        statistics::increment(accept_no_memory_stat);
+        BOOST_LOG_SEV(log, severity_level::error) << system_error(ec, "accept").what();
+        break;
+
+    default:
+        statistics::increment(accept_errors_stat);
+        BOOST_LOG_SEV(log, severity_level::error) << system_error(ec, "accept").what();
+        break;
+    }
+
+    suspend_accept(l);
+    return false;
+}
+
+void proxy::shed_accept(listener& l)
+{
+    if (reserve_fd == -1)
+        return open_reserve_fd();
+
+    close(reserve_fd);
+    reserve_fd = -1;
+    for (unsigned i = 0; i < accept_batch; ++i)
+    {
+        int fd = accept4(l.acceptor.native(), 0, 0, SOCK_CLOEXEC);
+        if (fd == -1)
+            break;
+        close(fd);
+        statistics::increment(accept_shed_stat);
+    }
+    open_reserve_fd();
+}
+
+void proxy::suspend_accept(listener& l)
+{
+    statistics::increment(accept_backoffs_stat);
+    l.backoff = std::min(std::max(l.backoff * 2, min_accept_backoff), max_accept_backoff);
+    ++l.suspended_accepts;
+    if (!l.backoff_timer.pending())
+        wheel.schedule(l.backoff_timer, l.backoff);
+}
+
+void proxy::resume_accept(listener& l)
+{
+    TRACE() << l.suspended_accepts;
+    unsigned suspended = l.suspended_accepts;
+    l.suspended_accepts = 0;
+    for (unsigned i = 0; i < suspended; ++i)
+    {
+#ifdef HAVE_IO_URING
+        if (ring)
+        {
+            start_ring_accept(l);
+            continue;
+        }
+#endif
+        start_accept(l);
+    }
+}
+
+void proxy::open_reserve_fd()
+{
+    reserve_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (reserve_fd == -1)
+        BOOST_LOG_SEV(log, severity_level::warning) << system_error(error_code(errno, boost::system::get_system_category()), "reserve fd").what();
+}
+
+#ifdef HAVE_IO_URING
+void proxy::start_ring_accept(listener& l)
+{
+    ring->async_accept(l.acceptor.native(), l.ring_op);
 }
 
+// multishot accept keeps delivering connections until kernel reports it is done
+void proxy::handle_ring_accept(int result, bool more, listener& l)
+{
+    if (result < 0)
+    {
+        error_code ec(-result, boost::system::get_system_category());
+        TRACE_ERROR(ec);
+        // multishot accept which is still armed keeps going by itself
+        if (!more && handle_accept_error(l, ec))
+            start_ring_accept(l);
+        return;
+    }
+
+    l.backoff = time_duration();
+    start_session(l, result);
+
+    if (!more)
+        start_ring_accept(l);
+}
+#endif
+
 void proxy::start_session(session* new_session)
 {
     TRACE() << new_session;
-    bool inserted = sessions.insert(new_session).second;
-    assert(inserted);
+    sessions.push_back(*new_session);
     new_session->start();
 }
 
+void proxy::start_session(listener& l, int fd)
+{
+    std::unique_ptr<session> new_sess(new (pool) session(l.acceptor.io_service(), *this));
+    error_code ec;
+    new_sess->socket().assign(l.protocol, fd, ec);
+    if (ec)
+    {
+        TRACE_ERROR(ec);
+        close(fd);
+        return;
+    }
+    start_session(new_sess.get());
+    new_sess.release();
+}
+
 void proxy::dump_channels_state() const
 {
     for (session_cont::const_iterator it = sessions.begin(); it != sessions.end(); ++it)
@@ -155,9 +366,9 @@ void proxy::dump_channels_state() const
     }
 }
 
-const ip::tcp::endpoint& proxy::get_outgoing_endpoint() const
+const ip::tcp::endpoint& proxy::get_outgoing_endpoint(const ip::tcp& protocol) const
 {
-    return outbound_http;
+    return protocol == ip::tcp::v6() ? outbound_http6 : outbound_http;
 }
 
 const time_duration& proxy::get_receive_timeout() const
@@ -170,12 +381,46 @@ const time_duration& proxy::get_connect_timeout() const
     return connect_timeout;
 }
 
+const time_duration& proxy::get_connect_attempt_delay() const
+{
+    return connect_attempt_delay;
+}
+
 const time_duration& proxy::get_resolve_timeout() const
 {
     return resolve_timeout;
 }
 
-const headers_type& proxy::get_allowed_headers() const
+long proxy::get_splice_budget() const
+{
+    return splice_budget;
+}
+
+bool proxy::get_client_keep_alive() const
+{
+    return client_keep_alive;
+}
+
+timing_wheel& proxy::get_timing_wheel()
+{
+    return wheel;
+}
+
+header_pool& proxy::get_header_pool()
+{
+    return header_buffers;
+}
+
+uring* proxy::get_uring()
+{
+#ifdef HAVE_IO_URING
+    return ring.get();
+#else
+    return 0;
+#endif
+}
+
+const header_table& proxy::get_allowed_headers() const
 {
     return allowed_headers;
 }
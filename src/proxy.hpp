@@ -8,23 +8,32 @@
 #ifndef PROXY_HPP_
 #define PROXY_HPP_
 
-#include <boost/ptr_container/ptr_set.hpp>
+#include <memory>
+#include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/asio.hpp>
 
 #include "common.hpp"
 #include "resolver.hpp"
 #include "session.hpp"
-#include "headers.hpp"
+#include "header_table.hpp"
+#include "uring.hpp"
+#include "timing_wheel.hpp"
+#include "session_pool.hpp"
+#include "header_pool.hpp"
 
 class proxy : public boost::noncopyable
 {
 public:
     proxy(asio::io_service& io, std::vector<ip::tcp::endpoint> inbound, const ip::tcp::endpoint& outbound_http,
-          const ip::udp::endpoint& outbound_ns, const ip::udp::endpoint& name_server,
-          const time_duration& receive_timeout, const time_duration& connect_timeout,
-          const time_duration& resolve_timeout, const std::vector<std::string>& allowed_headers,
+          const ip::tcp::endpoint& outbound_http6, const ip::udp::endpoint& outbound_ns, const std::vector<ip::udp::endpoint>& name_servers,
+          const time_duration& receive_timeout, const time_duration& connect_timeout, const time_duration& connect_attempt_delay,
+          const time_duration& resolve_timeout, const time_duration& timer_resolution, long splice_budget, const std::vector<std::string>& allowed_headers,
           const std::vector<std::string>& rename_headers,
-          std::string error_pages_dir, bool use_unbound_resolve);
+          const std::vector<std::string>& set_headers, const std::vector<std::string>& add_headers, bool forwarded_for, const std::string& via,
+          std::string error_pages_dir, resolver::library resolve_library, const stub_resolver::config& stub_config, bool resolve_ipv6, bool reuse_port, unsigned uring_entries,
+          std::size_t session_pool_prealloc, unsigned accept_batch, unsigned accepts_per_listener, std::size_t max_header_size,
+          bool client_keep_alive);
+    ~proxy();
 
     // called by main (parent)
     void start();
@@ -35,35 +44,98 @@ public:
     // called by session (child)
     void finished_session(session* session, const boost::system::error_code& ec);
 
-    const ip::tcp::endpoint& get_outgoing_endpoint() const;
+    // address to bind outgoing connections of protocol to
+    const ip::tcp::endpoint& get_outgoing_endpoint(const ip::tcp& protocol) const;
     const time_duration& get_receive_timeout() const;
     const time_duration& get_connect_timeout() const;
+    const time_duration& get_connect_attempt_delay() const;
     const time_duration& get_resolve_timeout() const;
+    long get_splice_budget() const;
+    bool get_client_keep_alive() const;
+
+    timing_wheel& get_timing_wheel();
+    // buffers of request headers larger than session keeps
+    header_pool& get_header_pool();
+
+    // io_uring engine shared by sessions, 0 if asio engine is used
+    uring* get_uring();
 
     void dump_channels_state() const;
 
-    const headers_type& get_allowed_headers() const;
+    const header_table& get_allowed_headers() const;
 
     asio::const_buffer get_error_page(http_error_code httpec) const;
 
 protected:
-    void start_accept(ip::tcp::acceptor& acceptor);
+    // http listening socket of the proxy
+    struct listener : public boost::noncopyable
+    {
+        listener(asio::io_service& io, const ip::tcp::endpoint& endpoint);
+
+        ip::tcp::acceptor acceptor;
+        ip::tcp protocol;
+        // accept operations which wait for backoff_timer after an error
+        unsigned suspended_accepts;
+        time_duration backoff;
+        timing_wheel::timer backoff_timer;
+#ifdef HAVE_IO_URING
+        uring::operation ring_op;
+#endif
+    };
 
-    void handle_accept(const boost::system::error_code& ec, session* new_session, ip::tcp::acceptor& acceptor);
+    void start_accept(listener& l);
+
+    void handle_accept(const boost::system::error_code& ec, session* new_session, listener& l);
+    // accepts up to accept_batch - 1 more connections which are already in backlog,
+    // returns false if accepting is suspended because of an error
+    bool drain_accept(listener& l);
+    // wraps accepted descriptor into new session
+    void start_session(listener& l, int fd);
     void start_session(session* new_session);
 
+    // returns true if accept may be restarted at once, otherwise the accept is suspended
+    // until backoff timer of listener fires
+    bool handle_accept_error(listener& l, const error_code& ec);
+    // accepts and closes pending clients while process is out of descriptors
+    void shed_accept(listener& l);
+    void suspend_accept(listener& l);
+    void resume_accept(listener& l);
+    void open_reserve_fd();
+
+#ifdef HAVE_IO_URING
+    void start_ring_accept(listener& l);
+    void handle_ring_accept(int result, bool more, listener& l);
+#endif
+
 private:
-    typedef boost::ptr_set<session, std::pointer_to_binary_function<const session&, const session&, bool> > session_cont;
-    typedef std::vector<boost::shared_ptr<ip::tcp::acceptor> > acceptor_vec;
-    acceptor_vec acceptors;
+    // sessions are linked in place, so registering and finishing one is O(1) and allocates nothing
+    typedef boost::intrusive::list<session, boost::intrusive::constant_time_size<true> > session_cont;
+    // receive, connect and resolve timeouts of all sessions
+    timing_wheel wheel;
+    boost::ptr_vector<listener> listeners;
+    // descriptor given up to accept and close a client when process runs out of descriptors
+    int reserve_fd;
+    // storage of sessions, declared before sessions so it outlives them
+    session_pool pool;
+    // declared before sessions, they give their header buffers back when destroyed
+    header_pool header_buffers;
+#ifdef HAVE_IO_URING
+    // declared before sessions, so it outlives operations embedded into them
+    std::unique_ptr<uring> ring;
+#endif
     resolver resolver_;
     ip::tcp::endpoint outbound_http;
+    ip::tcp::endpoint outbound_http6;
     time_duration receive_timeout;
     time_duration connect_timeout;
+    time_duration connect_attempt_delay;
     time_duration resolve_timeout;
+    long splice_budget;
+    unsigned accept_batch;
+    unsigned accepts_per_listener;
+    bool client_keep_alive;
     session_cont sessions;
-    std::vector<std::string> headers;                       // Stores actual header strings
-    headers_type allowed_headers;                           // Stores 'lstring' for quick header processing
+    header_table allowed_headers;
     std::vector<char> error_pages[HTTP_END - HTTP_BEGIN];
     static logger log;
 };
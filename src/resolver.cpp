@@ -5,12 +5,67 @@
  *      Author: nbryskin
  */
 
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <limits>
+#include <mutex>
 #include <boost/function.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
 #include <boost/log/sources/channel_feature.hpp>
 #include "resolver.hpp"
+#include "statistics.hpp"
 
 logger resolver::log = logger(keywords::channel = "resolver");
 
+static const statistics::counter dns_queries_stat("dns_queries");
+static const statistics::counter dns_coalesced_stat("dns_coalesced");
+static const statistics::counter dns_refreshes_stat("dns_refreshes");
+static const statistics::counter dns_refreshes_failed_stat("dns_refreshes_failed");
+
+// counters of n-th name server of udns library
+struct name_server_counters
+{
+    explicit name_server_counters(std::size_t index)
+        : prefix("dns_server" + boost::lexical_cast<std::string>(index))
+        , queries_name(prefix + "_queries")
+        , failures_name(prefix + "_failures")
+        , hedges_name(prefix + "_hedges")
+        , hedge_wins_name(prefix + "_hedge_wins")
+        , rtt_name(prefix + "_rtt")
+        , queries(queries_name.c_str())
+        , failures(failures_name.c_str())
+        , hedges(hedges_name.c_str())
+        , hedge_wins(hedge_wins_name.c_str())
+        , rtt(rtt_name.c_str(), statistics::seconds)
+    {
+    }
+
+    std::string prefix;
+    std::string queries_name;
+    std::string failures_name;
+    std::string hedges_name;
+    std::string hedge_wins_name;
+    std::string rtt_name;
+    // attempts sent to server, failed with temporary failure, sent as hedge,
+    // won as hedge and total time of answered attempts
+    statistics::counter queries;
+    statistics::counter failures;
+    statistics::counter hedges;
+    statistics::counter hedge_wins;
+    statistics::counter rtt;
+};
+
+// shared by resolvers of all workers, created while proxies are created at startup
+static boost::ptr_vector<name_server_counters> server_counters;
+static std::mutex server_counters_mutex;
+
+// hedge is sent when the first server is late by this much over its smoothed rtt
+static const double min_hedge_delay = 0.01;
+static const double max_hedge_delay = 1;
+static const double initial_hedge_delay = 0.1;
+
 struct ub_create_error: std::exception { char const* what() const throw() { return "failed to create unbound context"; } };
 struct ub_config_error: std::exception { char const* what() const throw() { return "failed to configure libunbound"; } };
 
@@ -19,12 +74,15 @@ void resolver::init()
     dns_init(0, 0);
 }
 
-resolver::resolver(asio::io_service& io, const ip::udp::endpoint& outbound, const ip::udp::endpoint& name_server, bool use_unbound_resolve)
+resolver::resolver(asio::io_service& io, const ip::udp::endpoint& outbound, const std::vector<ip::udp::endpoint>& name_servers,
+        library resolve_library, const stub_resolver::config& stub_config, bool resolve_ipv6)
     : socket(io)
     , timer(io)
-    , udns_context(dns_new(0))
+    , hedge_timer(io)
     , unbound_context(ub_ctx_create())
-    , use_unbound(use_unbound_resolve)
+    , backend(resolve_library)
+    , resolve_ipv6(resolve_ipv6)
+    , last_id(0)
 {
     if (unbound_resolve_enabled())
     {
@@ -37,68 +95,386 @@ resolver::resolver(asio::io_service& io, const ip::udp::endpoint& outbound, cons
         if (ub_ctx_set_option(unbound_context, const_cast<char*>("verbosity:"), const_cast<char*>("1"))) throw ub_config_error();
         if (ub_ctx_set_option(unbound_context, const_cast<char*>("outgoing-range:"), const_cast<char*>("4096"))) throw ub_config_error();
         if (ub_ctx_set_option(unbound_context, const_cast<char*>("num-queries-per-thread:"), const_cast<char*>("4096"))) throw ub_config_error();
+        // forward to given name servers instead of iterating from root ones
+        for (std::size_t i = 0; i < name_servers.size(); ++i)
+        {
+            std::string address = name_servers[i].address().to_string() + "@" + boost::lexical_cast<std::string>(name_servers[i].port());
+            if (ub_ctx_set_fwd(unbound_context, const_cast<char*>(address.c_str()))) throw ub_config_error();
+            if (name_servers[i].address().is_loopback())
+                if (ub_ctx_set_option(unbound_context, const_cast<char*>("do-not-query-localhost:"), const_cast<char*>("no"))) throw ub_config_error();
+        }
         int fd = ub_fd(unbound_context);
         socket.assign(ip::udp::v4(), fd);
     }
+    else if (backend == builtin)
+    {
+        stub.reset(new stub_resolver(io, outbound, name_servers, stub_config, &resolver::stub_finished_resolve_raw));
+    }
     else
     {
-        dns_add_serv_s(udns_context, 0);
-        dns_add_serv_s(udns_context, name_server.data());
-        socket.assign(ip::udp::v4(), dns_open(udns_context));
-        socket.bind(outbound);
-        socket.connect(name_server);
+        for (std::size_t i = 0; i < name_servers.size(); ++i)
+            add_name_server(io, outbound, name_servers[i]);
     }
 }
 
 resolver::~resolver()
 {
-    dns_free(udns_context);
+    for (queries_t::iterator it = queries.begin(); it != queries.end(); ++it)
+        delete it->second;
+    // pending udns queries are freed with their contexts
+    for (boost::ptr_vector<name_server>::iterator it = servers.begin(); it != servers.end(); ++it)
+        dns_free(it->context);
     ub_ctx_delete(unbound_context);
 }
 
+resolver::name_server::name_server(asio::io_service& io)
+    : socket(io)
+    , srtt(0)
+    , rttvar(0)
+    , loss(0)
+{
+}
+
+void resolver::add_name_server(asio::io_service& io, const ip::udp::endpoint& outbound, const ip::udp::endpoint& address)
+{
+    std::unique_ptr<name_server> server(new name_server(io));
+    server->index = servers.size();
+    server->context = dns_new(0);
+    dns_add_serv_s(server->context, 0);
+    dns_add_serv_s(server->context, address.data());
+    server->socket.assign(ip::udp::v4(), dns_open(server->context));
+    server->socket.bind(outbound);
+    server->socket.connect(address);
+    servers.push_back(server.release());
+
+    std::lock_guard<std::mutex> lock(server_counters_mutex);
+    while (server_counters.size() < servers.size())
+        server_counters.push_back(new name_server_counters(server_counters.size()));
+}
+
 bool resolver::unbound_resolve_enabled() const
 {
-    return use_unbound;
+    return backend == unbound;
 }
 
 void resolver::start()
 {
-    start_waiting_receive();
+    if (stub)
+        return stub->start();
+    if (unbound_resolve_enabled())
+        return start_waiting_receive();
+    for (boost::ptr_vector<name_server>::iterator it = servers.begin(); it != servers.end(); ++it)
+        start_waiting_receive(*it);
 }
 
 int resolver::async_resolve(const char* host_name, const callback& completion)
 {
     TRACE() << host_name;
 
-    int asyncid = 0;
+    std::string name(host_name);
+    boost::algorithm::to_lower(name);
 
-    if (unbound_resolve_enabled())
+    dns_cache* cache = dns_cache::instance();
+    dns_cache::record record;
+    bool refresh;
+    if (cache && cache->find(name, record, refresh))
     {
-        int retval = ub_resolve_async(unbound_context, const_cast<char*>(host_name),
-            1 /* TYPE A (IPv4 address) */, 
-            1 /* CLASS IN (internet) */, 
-            const_cast<callback*>(&completion), &resolver::unbound_finished_resolve_raw, &asyncid);
-        if(retval != 0)
-            completion(boost::system::error_code(retval, boost::system::get_generic_category()), 0, 0);
+        int error;
+        if (refresh)
+        {
+            if (queries.find(name) == queries.end() && start_query(name, true, error))
+                statistics::increment(dns_refreshes_stat);
+            else
+                cache->cancel_refresh(name);
+        }
+        complete(completion, record);
+        return 0;
     }
-    else
+
+    int id = last_id = std::max(last_id + 1, 1);
+
+    queries_t::iterator it = queries.find(name);
+    if (it != queries.end())
+    {
+        statistics::increment(dns_coalesced_stat);
+        it->second->waiters.push_back(std::make_pair(id, &completion));
+        waiters[id] = it->second;
+        return id;
+    }
+
+    int error;
+    query* q = start_query(name, false, error);
+    if (!q)
+    {
+        completion(boost::system::error_code(error, boost::system::get_generic_category()), 0, 0);
+        return 0;
+    }
+
+    q->waiters.push_back(std::make_pair(id, &completion));
+    waiters[id] = q;
+    return id;
+}
+
+resolver::query* resolver::start_query(const std::string& name, bool refresh, int& error)
+{
+    std::unique_ptr<query> q(new query());
+    q->owner = this;
+    q->name = name;
+    q->parts = 0;
+    q->error = 0;
+    q->cacheable = true;
+    q->refresh = refresh;
+    q->ttl = std::numeric_limits<unsigned>::max();
+    q->record.size = 0;
+    for (std::size_t i = 0; i < 2; ++i)
     {
-        dns_query* query = dns_submit_p(udns_context, host_name, DNS_C_IN, DNS_T_A, 0, dns_parse_a4, &resolver::udns_finished_resolve_raw, const_cast<callback*>(&completion));
-        if (query == 0)
-            completion(boost::system::error_code(dns_status(udns_context), boost::system::get_generic_category()), 0, 0);
+        q->lookups[i].q = q.get();
+        q->lookups[i].hedge = hedges.end();
+    }
+    statistics::increment(dns_queries_stat);
+
+    bool submitted = submit(q.get(), DNS_T_A);
+    if (resolve_ipv6)
+        submitted = submit(q.get(), DNS_T_AAAA) || submitted;
+    if (backend == udns)
         start_waiting_timer();
+    if (!submitted)
+    {
+        error = q->error;
+        return 0;
     }
 
-    return asyncid;
+    queries[name] = q.get();
+    return q.release();
 }
 
-int resolver::cancel(int asyncid)
+// returns false and sets query error if lookup could not be started
+bool resolver::submit(query* q, int type)
 {
     if (unbound_resolve_enabled())
     {
-        return ub_cancel(unbound_context, asyncid);
+        int asyncid = 0;
+        int retval = ub_resolve_async(unbound_context, const_cast<char*>(q->name.c_str()),
+            type, 1 /* CLASS IN (internet) */,
+            q, &resolver::unbound_finished_resolve_raw, &asyncid);
+        if (retval != 0)
+        {
+            q->error = retval;
+            return false;
+        }
     }
+    else if (stub)
+    {
+        if (!stub->submit(q->name, type, q))
+        {
+            q->error = DNS_E_BADQUERY;
+            return false;
+        }
+    }
+    else if (!submit_udns(q, type))
+    {
+        return false;
+    }
+    ++q->parts;
+    return true;
+}
 
+bool resolver::submit_udns(query* q, int type)
+{
+    udns_lookup* lookup = &q->lookups[type == DNS_T_AAAA];
+    lookup->type = type;
+    lookup->sent = 0;
+    lookup->running = 0;
+    std::size_t server = best_name_server(servers.size());
+    if (!start_udns_attempt(lookup, server))
+        return false;
+
+    if (servers.size() > 1)
+    {
+        const name_server& s = servers[server];
+        double delay = s.srtt == 0 ? initial_hedge_delay : std::min(std::max(s.srtt + 4 * s.rttvar, min_hedge_delay), max_hedge_delay);
+        boost::posix_time::ptime at = lookup->attempts[0].started + boost::posix_time::microseconds(long(delay * 1e6));
+        lookup->hedge = hedges.insert(hedges_t::value_type(at, lookup));
+        if (lookup->hedge == hedges.begin())
+            start_waiting_hedge_timer();
+    }
+    return true;
+}
+
+// server expected to answer first, servers without rtt are tried first to get one
+std::size_t resolver::best_name_server(std::size_t excluded) const
+{
+    std::size_t best = excluded;
+    double best_score = 0;
+    for (std::size_t i = 0; i < servers.size(); ++i)
+    {
+        if (i == excluded)
+            continue;
+        double score = servers[i].srtt / (1 - std::min(servers[i].loss, 0.9));
+        if (best == excluded || score < best_score)
+        {
+            best = i;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+// returns false and sets query error if attempt could not be started
+bool resolver::start_udns_attempt(udns_lookup* lookup, std::size_t server)
+{
+    query* q = lookup->q;
+    udns_attempt& attempt = lookup->attempts[lookup->sent];
+    dns_ctx* context = servers[server].context;
+    attempt.lookup = lookup;
+    attempt.server = server;
+    attempt.started = asio::deadline_timer::traits_type::now();
+    attempt.handle = lookup->type == DNS_T_AAAA
+        ? dns_submit_p(context, q->name.c_str(), DNS_C_IN, DNS_T_AAAA, 0, dns_parse_a6, &resolver::udns_finished_resolve6_raw, &attempt)
+        : dns_submit_p(context, q->name.c_str(), DNS_C_IN, DNS_T_A, 0, dns_parse_a4, &resolver::udns_finished_resolve_raw, &attempt);
+    if (attempt.handle == 0)
+    {
+        q->error = dns_status(context);
+        return false;
+    }
+
+    statistics::increment(server_counters[server].queries);
+    ++lookup->sent;
+    ++lookup->running;
+    return true;
+}
+
+void resolver::start_waiting_hedge_timer()
+{
+    if (hedges.empty())
+        return;
+    hedge_timer.expires_at(hedges.begin()->first);
+    hedge_timer.async_wait(boost::bind(&resolver::finished_waiting_hedge_timer, this, placeholders::error));
+}
+
+void resolver::finished_waiting_hedge_timer(const error_code& ec)
+{
+    // timer is moved when an earlier hedge is scheduled
+    if (ec)
+        return;
+
+    boost::posix_time::ptime now = asio::deadline_timer::traits_type::now();
+    bool started = false;
+    while (!hedges.empty() && hedges.begin()->first <= now)
+    {
+        udns_lookup* lookup = hedges.begin()->second;
+        hedges.erase(hedges.begin());
+        lookup->hedge = hedges.end();
+
+        std::size_t server = best_name_server(lookup->attempts[0].server);
+        TRACE() << lookup->q->name << " " << server;
+        int error = lookup->q->error;
+        if (start_udns_attempt(lookup, server))
+        {
+            statistics::increment(server_counters[server].hedges);
+            started = true;
+        }
+        lookup->q->error = error;
+    }
+    // udns sends submitted queries from dns_timeouts() only
+    if (started)
+        start_waiting_timer();
+    start_waiting_hedge_timer();
+}
+
+void resolver::cancel_hedge(udns_lookup* lookup)
+{
+    if (lookup->hedge == hedges.end())
+        return;
+    // timer stays armed, the handler finds nothing to do
+    hedges.erase(lookup->hedge);
+    lookup->hedge = hedges.end();
+}
+
+bool resolver::finished_udns_attempt(udns_attempt* attempt, int status)
+{
+    udns_lookup* lookup = attempt->lookup;
+    attempt->handle = 0;
+    --lookup->running;
+    double rtt = (asio::deadline_timer::traits_type::now() - attempt->started).total_microseconds() * 1e-6;
+    bool failed = status == DNS_E_TEMPFAIL;
+    update_name_server(attempt->server, rtt, failed);
+
+    if (failed)
+    {
+        // failed server is not waited for, the other one is asked at once
+        if (lookup->sent < 2 && servers.size() > 1)
+        {
+            cancel_hedge(lookup);
+            std::size_t server = best_name_server(attempt->server);
+            int error = lookup->q->error;
+            if (start_udns_attempt(lookup, server))
+            {
+                statistics::increment(server_counters[server].hedges);
+                return false;
+            }
+            lookup->q->error = error;
+        }
+        if (lookup->running > 0)
+            return false;
+    }
+
+    if (attempt == &lookup->attempts[1] && !failed)
+        statistics::increment(server_counters[attempt->server].hedge_wins);
+
+    cancel_hedge(lookup);
+    for (std::size_t i = 0; i < lookup->sent; ++i)
+    {
+        udns_attempt& other = lookup->attempts[i];
+        if (!other.handle)
+            continue;
+        // loser was at least this slow
+        update_name_server(other.server, rtt + (attempt->started - other.started).total_microseconds() * 1e-6, false);
+        dns_cancel(servers[other.server].context, other.handle);
+        other.handle = 0;
+        --lookup->running;
+    }
+    return true;
+}
+
+void resolver::update_name_server(std::size_t server, double rtt, bool failed)
+{
+    name_server& s = servers[server];
+    s.loss += 0.1 * ((failed ? 1 : 0) - s.loss);
+    if (failed)
+    {
+        statistics::increment(server_counters[server].failures);
+        return;
+    }
+
+    statistics::increment(server_counters[server].rtt, rtt);
+    if (s.srtt == 0)
+    {
+        s.srtt = rtt;
+        s.rttvar = rtt / 2;
+        return;
+    }
+    s.rttvar += 0.25 * (std::abs(s.srtt - rtt) - s.rttvar);
+    s.srtt += 0.125 * (rtt - s.srtt);
+}
+
+int resolver::cancel(int asyncid)
+{
+    waiters_t::iterator it = waiters.find(asyncid);
+    if (it == waiters.end())
+        return -1;
+
+    // other waiters and cache still need the answer, so query keeps running
+    std::vector<std::pair<int, const callback*> >& query_waiters = it->second->waiters;
+    for (std::size_t i = 0; i < query_waiters.size(); ++i)
+    {
+        if (query_waiters[i].first == asyncid)
+        {
+            query_waiters.erase(query_waiters.begin() + i);
+            break;
+        }
+    }
+    waiters.erase(it);
     return 0;
 }
 
@@ -114,26 +490,39 @@ void resolver::finished_waiting_receive(const boost::system::error_code& ec)
     if (ec)
         return;
 
-    if (unbound_resolve_enabled())
-    {
-        ub_process(unbound_context);
-    }
-    else
-    {
-        dns_ioevent(udns_context, 0);
-    }
+    ub_process(unbound_context);
 
     start_waiting_receive();
+}
 
-    if (!unbound_resolve_enabled())
-    {
-        start_waiting_timer();
-    }
+void resolver::start_waiting_receive(name_server& server)
+{
+    server.socket.async_receive(asio::null_buffers(), boost::bind(&resolver::finished_waiting_receive, this, placeholders::error, boost::ref(server)));
+}
+
+void resolver::finished_waiting_receive(const boost::system::error_code& ec, name_server& server)
+{
+    TRACE_ERROR(ec) << server.index;
+    if (ec)
+        return;
+
+    dns_ioevent(server.context, 0);
+
+    start_waiting_receive(server);
+
+    start_waiting_timer();
 }
 
 void resolver::start_waiting_timer()
 {
-    int seconds = dns_timeouts(udns_context, -1, 0);
+    // also retries and fails timed out queries of every context
+    int seconds = -1;
+    for (boost::ptr_vector<name_server>::iterator it = servers.begin(); it != servers.end(); ++it)
+    {
+        int server_seconds = dns_timeouts(it->context, -1, 0);
+        if (server_seconds >= 0 && (seconds < 0 || server_seconds < seconds))
+            seconds = server_seconds;
+    }
     TRACE() << seconds;
     if (seconds < 0)
         return;
@@ -147,70 +536,173 @@ void resolver::finished_waiting_timer(const error_code& ec)
     if (ec)
         return;
 
-    dns_ioevent(udns_context, 0);
-
     start_waiting_timer();
 }
 
 void resolver::udns_finished_resolve_raw(dns_ctx* ctx, void* result, void* data)
 {
-    const callback& completion = *static_cast<const callback*>(data);
-    dns_rr_a4& response = *static_cast<dns_rr_a4*>(result);
-
+    udns_attempt* attempt = static_cast<udns_attempt*>(data);
+    query* q = attempt->lookup->q;
     int status = dns_status(ctx);
-    udns_finished_resolve(status, response, completion);
+    if (!q->owner->finished_udns_attempt(attempt, status))
+        return free(result);
+    const dns_rr_a4* response = static_cast<dns_rr_a4*>(result);
+    unsigned ttl = 0;
+    if (status >= 0)
+    {
+        for (int i = 0; i < response->dnsa4_nrr; i++)
+        {
+            ip::address_v4::bytes_type bytes;
+            std::memcpy(bytes.data(), response->dnsa4_addr + i, bytes.size());
+            add_address(q, ip::address_v4(bytes));
+        }
+        ttl = response->dnsa4_ttl;
+        status = response->dnsa4_nrr ? 0 : DNS_E_NODATA;
+    }
+    free(result);
+    q->owner->finished_part(q, status, udns_cacheable(status), ttl);
+}
 
+void resolver::udns_finished_resolve6_raw(dns_ctx* ctx, void* result, void* data)
+{
+    udns_attempt* attempt = static_cast<udns_attempt*>(data);
+    query* q = attempt->lookup->q;
+    int status = dns_status(ctx);
+    if (!q->owner->finished_udns_attempt(attempt, status))
+        return free(result);
+    const dns_rr_a6* response = static_cast<dns_rr_a6*>(result);
+    unsigned ttl = 0;
+    if (status >= 0)
+    {
+        for (int i = 0; i < response->dnsa6_nrr; i++)
+        {
+            ip::address_v6::bytes_type bytes;
+            std::memcpy(bytes.data(), response->dnsa6_addr + i, bytes.size());
+            add_address(q, ip::address_v6(bytes));
+        }
+        ttl = response->dnsa6_ttl;
+        status = response->dnsa6_nrr ? 0 : DNS_E_NODATA;
+    }
     free(result);
+    q->owner->finished_part(q, status, udns_cacheable(status), ttl);
 }
 
-void resolver::unbound_finished_resolve_raw(void* data, int status, ub_result* result)
+// udns reports SERVFAIL and timeout alike (DNS_E_TEMPFAIL), so neither is cached:
+// one lost packet must not fail the name for all workers
+bool resolver::udns_cacheable(int status)
 {
-    const callback& completion = *static_cast<const callback*>(data);
-    unbound_finished_resolve(status, result, completion);
-    ub_resolve_free(result);
+    return status == DNS_E_NXDOMAIN || status == DNS_E_NODATA;
 }
 
-void resolver::udns_finished_resolve(int status, const dns_rr_a4& response, const callback& completion)
+void resolver::unbound_finished_resolve_raw(void* data, int status, ub_result* result)
 {
     TRACE() << status;
-    iterator begin, end;
-    boost::system::error_code ec = boost::system::error_code(status, boost::system::get_generic_category());
+    query* q = static_cast<query*>(data);
+    if (status != 0)
+    {
+        ub_resolve_free(result);
+        return q->owner->finished_part(q, status, false, 0);
+    }
 
-    std::vector<char*> addrs;
+    if (!result->havedata)
+    {
+        int error = result->rcode ? result->rcode : boost::system::errc::operation_canceled;
+        // NOERROR without data, SERVFAIL, NXDOMAIN
+        bool cacheable = result->rcode == 0 || result->rcode == 2 || result->rcode == 3;
+        ub_resolve_free(result);
+        return q->owner->finished_part(q, error, cacheable, 0);
+    }
 
-    if (status >= 0)
+    for (char** data = result->data; *data; ++data)
     {
-        for (int i = 0; i < response.dnsa4_nrr; i++)
+        if (result->qtype == DNS_T_AAAA)
         {
-            addrs.push_back(reinterpret_cast<char*>(response.dnsa4_addr + i));
+            ip::address_v6::bytes_type bytes;
+            std::memcpy(bytes.data(), *data, bytes.size());
+            add_address(q, ip::address_v6(bytes));
+        }
+        else
+        {
+            ip::address_v4::bytes_type bytes;
+            std::memcpy(bytes.data(), *data, bytes.size());
+            add_address(q, ip::address_v4(bytes));
         }
-
-        begin   = &addrs[0];
-        end     = &addrs[addrs.size()];
     }
-    completion(ec, begin, end);
+    unsigned ttl = result->ttl;
+    ub_resolve_free(result);
+    q->owner->finished_part(q, 0, true, ttl);
 }
 
-void resolver::unbound_finished_resolve(int status, ub_result* result, const callback& completion)
+void resolver::stub_finished_resolve_raw(void* data, const stub_resolver::answer& result)
 {
-    TRACE() << status;
-    iterator begin, end;
-    boost::system::error_code ec;
-    if (status == 0)
+    query* q = static_cast<query*>(data);
+    for (std::size_t i = 0; i < result.size; ++i)
+        add_address(q, result.addresses[i]);
+    q->owner->finished_part(q, result.error, udns_cacheable(result.error) || result.servfail, result.ttl);
+}
+
+void resolver::add_address(query* q, const ip::address& address)
+{
+    dns_cache::record& record = q->record;
+    if (record.size == dns_cache::max_addresses)
+        return;
+
+    // IPv6 addresses go first
+    std::size_t pos = record.size;
+    if (address.is_v6())
     {
-        if (result->havedata)
-        {
-            begin = result->data;
-            for (end = begin; end; ++end);
-        }
-        else
+        while (pos > 0 && record.addresses[pos - 1].is_v4())
         {
-            ec = boost::system::error_code(result->rcode ? result->rcode : boost::system::errc::operation_canceled, boost::system::get_generic_category());
+            record.addresses[pos] = record.addresses[pos - 1];
+            --pos;
         }
     }
+    record.addresses[pos] = address;
+    ++record.size;
+}
+
+void resolver::finished_part(query* q, int error, bool cacheable, unsigned ttl)
+{
+    TRACE() << q->name << " " << error << " " << ttl;
+    if (error)
+    {
+        if (!q->error)
+            q->error = error;
+        q->cacheable = q->cacheable && cacheable;
+    }
     else
     {
-        ec = boost::system::error_code(status, boost::system::get_generic_category());
+        q->ttl = std::min(q->ttl, ttl);
     }
-    completion(ec, begin, end);
+
+    if (--q->parts == 0)
+        finished_query(q);
+}
+
+void resolver::finished_query(query* q)
+{
+    TRACE() << q->name << " " << q->record.size << " " << q->waiters.size();
+    std::unique_ptr<query> holder(q);
+    queries.erase(q->name);
+    for (std::size_t i = 0; i < q->waiters.size(); ++i)
+        waiters.erase(q->waiters[i].first);
+
+    q->record.error = q->record.size ? 0 : q->error;
+    // failed refresh leaves cached entry to expire
+    if (q->refresh && q->record.error)
+        statistics::increment(dns_refreshes_failed_stat);
+    dns_cache* cache = dns_cache::instance();
+    if (cache && (q->record.size || (q->cacheable && !q->refresh)))
+        cache->insert(q->name, q->record, q->ttl);
+
+    for (std::size_t i = 0; i < q->waiters.size(); ++i)
+        complete(*q->waiters[i].second, q->record);
+}
+
+void resolver::complete(const callback& completion, const dns_cache::record& record)
+{
+    if (record.error)
+        return completion(boost::system::error_code(record.error, boost::system::get_generic_category()), 0, 0);
+
+    completion(boost::system::error_code(), record.addresses, record.addresses + record.size);
 }
@@ -8,54 +8,57 @@
 #ifndef RESOLVER_HPP_
 #define RESOLVER_HPP_
 
+#include <string>
+#include <vector>
+#include <memory>
+#include <map>
+#include <unordered_map>
 #include <boost/function.hpp>
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <boost/bind/placeholders.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/log/sources/channel_logger.hpp>
 #include <udns.h>
 #include <unbound.h>
 
 #include "common.hpp"
+#include "dns_cache.hpp"
+#include "stub_resolver.hpp"
 
 using boost::system::error_code;
 
 class resolver
 {
 public:
-    class iterator
+    // addresses of resolved host, IPv6 ones first
+    typedef const ip::address* iterator;
+    typedef boost::function<void (const boost::system::error_code&, iterator, iterator)> callback;
+
+    enum library
     {
-    public:
-        iterator(char** ptr=0)
-        : ptr(reinterpret_cast<ip::address_v4**>(ptr))
-        {
-        }
-        ip::address_v4& operator * ()
-        {
-            return **ptr;
-        }
-        iterator& operator ++ ()
-        {
-            ptr++;
-            return *this;
-        }
-        operator bool ()
-        {
-            return *ptr;
-        }
-    private:
-        ip::address_v4** ptr;
+        udns,
+        unbound,
+        builtin,    // stub_resolver
     };
-    typedef boost::function<void (const boost::system::error_code&, iterator, iterator)> callback;
 
     static void init();
 
-    resolver(asio::io_service& io, const ip::udp::endpoint& outbound, const ip::udp::endpoint& name_server, bool use_unbound_resolve);
+    // resolve_ipv6: look up AAAA records along with A ones
+    // name_servers are used by udns and builtin libraries, unbound library
+    // forwards queries to them if there are any
+    resolver(asio::io_service& io, const ip::udp::endpoint& outbound, const std::vector<ip::udp::endpoint>& name_servers,
+            library resolve_library, const stub_resolver::config& stub_config, bool resolve_ipv6);
     ~resolver();
 
     void start();
 
+    // completion is called at once if host name is cached, otherwise it
+    // must stay valid until it is called or canceled; concurrent lookups
+    // of the same name wait for a single query; hot cached names are
+    // looked up again in background before they expire
     int async_resolve(const char* host_name, const callback& completion);
+    // returns 0 if completion will not be called
     int cancel(int asyncid);
 
 protected:
@@ -67,20 +70,115 @@ protected:
     void start_waiting_timer();
     void finished_waiting_timer(const error_code& ec);
 
+    // udns name server with its own context, lookups go to the fastest healthy one
+    struct name_server
+    {
+        explicit name_server(asio::io_service& io);
+
+        std::size_t index;
+        dns_ctx* context;
+        ip::udp::socket socket;
+        // smoothed round trip time and its variation, seconds
+        double srtt;
+        double rttvar;
+        // fraction of lookups failed temporarily
+        double loss;
+    };
+
+    struct query;
+    struct udns_lookup;
+
+    struct udns_attempt
+    {
+        udns_lookup* lookup;
+        std::size_t server;
+        dns_query* handle;
+        boost::posix_time::ptime started;
+    };
+
+    typedef std::multimap<boost::posix_time::ptime, udns_lookup*> hedges_t;
+
+    // A or AAAA lookup sent through udns, it is hedged to another name server
+    // when the first one does not answer in time
+    struct udns_lookup
+    {
+        query* q;
+        int type;
+        udns_attempt attempts[2];
+        // attempts sent and still running
+        std::size_t sent;
+        std::size_t running;
+        // hedges.end() if hedge is not scheduled
+        hedges_t::iterator hedge;
+    };
+
+    // lookup of one host name shared by all sessions which wait for it
+    struct query
+    {
+        resolver* owner;
+        std::string name;
+        // A and AAAA lookups still running
+        int parts;
+        // error of the first failed lookup, query fails only if no lookup found addresses
+        int error;
+        bool cacheable;
+        // background lookup of cached name, failure keeps cached entry
+        bool refresh;
+        unsigned ttl;
+        dns_cache::record record;
+        // canceled waiters are removed, query keeps running to fill cache
+        std::vector<std::pair<int, const callback*> > waiters;
+        // A and AAAA lookups of udns library
+        udns_lookup lookups[2];
+    };
+
+    // returns 0 and sets error if no lookup could be started
+    query* start_query(const std::string& name, bool refresh, int& error);
+    bool submit(query* q, int type);
+
+    void add_name_server(asio::io_service& io, const ip::udp::endpoint& outbound, const ip::udp::endpoint& address);
+    void start_waiting_receive(name_server& server);
+    void finished_waiting_receive(const boost::system::error_code& ec, name_server& server);
+    bool submit_udns(query* q, int type);
+    std::size_t best_name_server(std::size_t excluded) const;
+    bool start_udns_attempt(udns_lookup* lookup, std::size_t server);
+    void start_waiting_hedge_timer();
+    void finished_waiting_hedge_timer(const error_code& ec);
+    void cancel_hedge(udns_lookup* lookup);
+    // returns false if lookup goes on, otherwise it is done with status of attempt
+    bool finished_udns_attempt(udns_attempt* attempt, int status);
+    void update_name_server(std::size_t server, double rtt, bool failed);
+
     static void udns_finished_resolve_raw(dns_ctx* ctx, void* result, void* data);
-    static void udns_finished_resolve(int status, const dns_rr_a4& response, const callback& completion);
+    static void udns_finished_resolve6_raw(dns_ctx* ctx, void* result, void* data);
+    // returns whether failure may be cached
+    static bool udns_cacheable(int status);
 
     static void unbound_finished_resolve_raw(void* data, int status, ub_result* result);
-    static void unbound_finished_resolve(int status, ub_result* result, const callback& completion);
+
+    static void stub_finished_resolve_raw(void* data, const stub_resolver::answer& result);
+
+    static void add_address(query* q, const ip::address& address);
+    void finished_part(query* q, int error, bool cacheable, unsigned ttl);
+    void finished_query(query* q);
+    static void complete(const callback& completion, const dns_cache::record& record);
 
 private:
-    typedef boost::function<void (int, const dns_rr_a4&)> resolve_callback_internal;
+    typedef std::unordered_map<std::string, query*> queries_t;
+    typedef std::unordered_map<int, query*> waiters_t;
 
     ip::udp::socket socket;
     asio::deadline_timer timer;
-    dns_ctx* udns_context;
+    boost::ptr_vector<name_server> servers;
+    hedges_t hedges;
+    asio::deadline_timer hedge_timer;
     ub_ctx* unbound_context;
-    bool use_unbound;
+    library backend;
+    std::unique_ptr<stub_resolver> stub;
+    bool resolve_ipv6;
+    queries_t queries;
+    waiters_t waiters;
+    int last_id;
     static logger log;
 };
 
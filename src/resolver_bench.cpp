@@ -0,0 +1,308 @@
+/*
+ * resolver_bench.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+// Resolver benchmark: looks up random names of a zone at a fixed rate through
+// resolver::async_resolve, cancels some of the lookups and prints throughput
+// and latency percentiles. Meant to run against test/fake_name_server.py, see
+// test/resolver_bench.py. DNS cache is not created, so every name which is not
+// being looked up already goes to the backend.
+
+#include <signal.h>
+
+#include <iostream>
+#include <deque>
+#include <map>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/program_options.hpp>
+#include <boost/log/core.hpp>
+#include <boost/log/utility/init/to_console.hpp>
+#include <boost/log/filters.hpp>
+
+#include "resolver.hpp"
+#include "endpoint.hpp"
+
+namespace po = boost::program_options;
+typedef std::vector<ip::udp::endpoint> ns_endpoint_vec;
+
+class resolver_bench : public boost::noncopyable
+{
+public:
+    struct config
+    {
+        // distinct names looked up
+        std::size_t names;
+        std::string zone;
+        // lookups per second
+        double rate;
+        time_duration duration;
+        // fraction of lookups canceled cancel_delay after they start
+        double cancel_ratio;
+        time_duration cancel_delay;
+        // time to wait for lookups still running after the last one started
+        time_duration drain;
+        unsigned seed;
+    };
+
+    resolver_bench(asio::io_service& io, resolver& r, const config& conf);
+
+    void start();
+    void report(std::ostream& os) const;
+
+protected:
+    struct request
+    {
+        std::size_t index;
+        int id;
+        bool done;
+        boost::posix_time::ptime started;
+        resolver::callback completion;
+    };
+
+    void start_waiting_timer();
+    void finished_waiting_timer(const error_code& ec);
+    void start_request();
+    void finished_request(const error_code& ec, resolver::iterator begin, resolver::iterator end, std::size_t index);
+    void cancel_requests(boost::posix_time::ptime now);
+
+private:
+    // the clock is sampled once per tick
+    static const long tick = 1;
+
+    asio::deadline_timer timer;
+    resolver& r;
+    config conf;
+    std::mt19937 random;
+    // lookups started during the run
+    std::size_t total;
+    std::vector<request> requests;
+    // lookups to cancel, in order of their deadlines
+    std::deque<std::pair<boost::posix_time::ptime, std::size_t> > cancels;
+    boost::posix_time::ptime began;
+    boost::posix_time::ptime finished;
+    std::size_t running;
+    std::size_t canceled;
+    std::size_t addresses;
+    // microseconds of completed lookups
+    std::vector<long> latencies;
+    // lookups failed by error code
+    std::map<int, std::size_t> errors;
+};
+
+resolver_bench::resolver_bench(asio::io_service& io, resolver& r, const config& conf)
+    : timer(io)
+    , r(r)
+    , conf(conf)
+    , random(conf.seed)
+    , total(std::size_t(conf.rate * conf.duration.total_microseconds() / 1e6) + 1)
+    , running(0)
+    , canceled(0)
+    , addresses(0)
+{
+    // requests must not move, resolver keeps pointers to their completions
+    requests.reserve(total);
+    latencies.reserve(total);
+}
+
+void resolver_bench::start()
+{
+    began = boost::posix_time::microsec_clock::universal_time();
+    timer.expires_at(began);
+    start_waiting_timer();
+}
+
+void resolver_bench::start_waiting_timer()
+{
+    timer.async_wait(boost::bind(&resolver_bench::finished_waiting_timer, this, placeholders::error));
+}
+
+void resolver_bench::finished_waiting_timer(const error_code& ec)
+{
+    if (ec)
+        return;
+
+    boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+    time_duration elapsed = now - began;
+    if (elapsed < conf.duration)
+    {
+        std::size_t due = std::min(total, std::size_t(conf.rate * elapsed.total_microseconds() / 1e6) + 1);
+        while (requests.size() < due)
+            start_request();
+    }
+    cancel_requests(now);
+
+    if (elapsed >= conf.duration && (running == 0 || elapsed >= conf.duration + conf.drain))
+    {
+        finished = now;
+        return timer.get_io_service().stop();
+    }
+
+    timer.expires_at(timer.expires_at() + boost::posix_time::milliseconds(tick));
+    start_waiting_timer();
+}
+
+void resolver_bench::start_request()
+{
+    std::string name = "h" + boost::lexical_cast<std::string>(random() % conf.names) + "." + conf.zone;
+
+    requests.push_back(request());
+    request& req = requests.back();
+    req.index = requests.size() - 1;
+    req.done = false;
+    req.started = boost::posix_time::microsec_clock::universal_time();
+    req.completion = boost::bind(&resolver_bench::finished_request, this, _1, _2, _3, req.index);
+    ++running;
+
+    // completion may be called before async_resolve returns
+    req.id = r.async_resolve(name.c_str(), req.completion);
+
+    if (!req.done && std::generate_canonical<double, 32>(random) < conf.cancel_ratio)
+        cancels.push_back(std::make_pair(req.started + conf.cancel_delay, req.index));
+}
+
+void resolver_bench::finished_request(const error_code& ec, resolver::iterator begin, resolver::iterator end, std::size_t index)
+{
+    request& req = requests[index];
+    req.done = true;
+    --running;
+    latencies.push_back((boost::posix_time::microsec_clock::universal_time() - req.started).total_microseconds());
+    if (ec)
+        ++errors[ec.value()];
+    else
+        addresses += end - begin;
+}
+
+void resolver_bench::cancel_requests(boost::posix_time::ptime now)
+{
+    for (; !cancels.empty() && cancels.front().first <= now; cancels.pop_front())
+    {
+        request& req = requests[cancels.front().second];
+        if (req.done || r.cancel(req.id) != 0)
+            continue;
+        req.done = true;
+        --running;
+        ++canceled;
+    }
+}
+
+static long percentile(const std::vector<long>& sorted, double fraction)
+{
+    if (sorted.empty())
+        return 0;
+    return sorted[std::min(sorted.size() - 1, std::size_t(sorted.size() * fraction))];
+}
+
+void resolver_bench::report(std::ostream& os) const
+{
+    std::vector<long> sorted(latencies);
+    std::sort(sorted.begin(), sorted.end());
+    double seconds = (finished - began).total_microseconds() / 1e6;
+    std::size_t failed = 0;
+    for (std::map<int, std::size_t>::const_iterator it = errors.begin(); it != errors.end(); ++it)
+        failed += it->second;
+
+    os << "started\t" << requests.size() << "\n"
+       << "completed\t" << latencies.size() << "\n"
+       << "failed\t" << failed << "\n"
+       << "canceled\t" << canceled << "\n"
+       << "unfinished\t" << running << "\n"
+       << "addresses\t" << addresses << "\n"
+       << "seconds\t" << seconds << "\n"
+       << "qps\t" << (seconds > 0 ? latencies.size() / seconds : 0) << "\n"
+       << "latency_p50\t" << percentile(sorted, 0.5) / 1e6 << "\n"
+       << "latency_p90\t" << percentile(sorted, 0.9) / 1e6 << "\n"
+       << "latency_p99\t" << percentile(sorted, 0.99) / 1e6 << "\n"
+       << "latency_p999\t" << percentile(sorted, 0.999) / 1e6 << "\n"
+       << "latency_max\t" << (sorted.empty() ? 0 : sorted.back()) / 1e6 << "\n";
+    for (std::map<int, std::size_t>::const_iterator it = errors.begin(); it != errors.end(); ++it)
+        os << "error" << it->first << "\t" << it->second << "\n";
+}
+
+int main(int argc, char* argv[])
+{
+    po::options_description desc("Allowed options");
+    desc.add_options()
+            ("help", "produce help message")
+            ("resolve-library", po::value<std::string>()->default_value("udns"), "DNS library to benchmark ('udns', 'unbound', 'builtin')")
+            ("name-server", po::value<ns_endpoint_vec>()->required(), "name server address, may be given several times")
+            ("outgoing-ns", po::value<ip::udp::endpoint>()->default_value(ip::udp::endpoint()), "outgoing address for NS lookup")
+            ("resolve-ipv6", po::value<bool>()->default_value(false), "look up AAAA records along with A ones")
+            ("builtin-sockets", po::value<std::size_t>()->default_value(4), "number of source ports used by 'builtin' library")
+            ("builtin-query-timeout", po::value<long>()->default_value(1000), "timeout of one try of query sent by 'builtin' library (in milliseconds)")
+            ("builtin-query-attempts", po::value<unsigned>()->default_value(3), "number of tries of query sent by 'builtin' library")
+            ("names", po::value<std::size_t>()->default_value(100000), "number of distinct names looked up")
+            ("zone", po::value<std::string>()->default_value("bench.example"), "zone of looked up names (unbound answers names under .test itself)")
+            ("rate", po::value<double>()->default_value(1000), "lookups started per second")
+            ("duration", po::value<long>()->default_value(10), "time of starting lookups (in seconds)")
+            ("cancel-ratio", po::value<double>()->default_value(0), "fraction of lookups canceled")
+            ("cancel-delay", po::value<long>()->default_value(10), "time after which lookup is canceled (in milliseconds)")
+            ("drain", po::value<long>()->default_value(5), "time to wait for running lookups after the last one started (in seconds)")
+            ("seed", po::value<unsigned>()->default_value(1), "seed of name choice")
+            ("log-level", po::value<int>()->default_value(3), "logging level");
+
+    po::variables_map vm;
+    try
+    {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        if (vm.count("help"))
+        {
+            std::cout << desc << std::endl;
+            return 1;
+        }
+        po::notify(vm);
+        if (vm["names"].as<std::size_t>() == 0)
+            throw po::invalid_option_value("names");
+        if (vm["rate"].as<double>() <= 0)
+            throw po::invalid_option_value("rate");
+    }
+    catch (const po::error& e)
+    {
+        std::cerr << e.what() << "\n" << desc << std::endl;
+        return 1;
+    }
+
+    boost::log::init_log_to_console(std::cerr);
+    boost::log::core::get()->set_filter
+    (
+        boost::log::filters::attr<severity_level>("Severity") >= vm["log-level"].as<int>()
+    );
+
+    const std::string& library = vm["resolve-library"].as<std::string>();
+    resolver::library resolve_library = library == "unbound" ? resolver::unbound : library == "builtin" ? resolver::builtin : resolver::udns;
+
+    stub_resolver::config stub_config;
+    stub_config.sockets = vm["builtin-sockets"].as<std::size_t>();
+    stub_config.timeout = boost::posix_time::milliseconds(vm["builtin-query-timeout"].as<long>());
+    stub_config.attempts = vm["builtin-query-attempts"].as<unsigned>();
+
+    resolver_bench::config conf;
+    conf.names = vm["names"].as<std::size_t>();
+    conf.zone = vm["zone"].as<std::string>();
+    conf.rate = vm["rate"].as<double>();
+    conf.duration = boost::posix_time::seconds(vm["duration"].as<long>());
+    conf.cancel_ratio = vm["cancel-ratio"].as<double>();
+    conf.cancel_delay = boost::posix_time::milliseconds(vm["cancel-delay"].as<long>());
+    conf.drain = boost::posix_time::seconds(vm["drain"].as<long>());
+    conf.seed = vm["seed"].as<unsigned>();
+
+    signal(SIGPIPE, SIG_IGN);
+    resolver::init();
+    asio::io_service io;
+    resolver r(io, vm["outgoing-ns"].as<ip::udp::endpoint>(), vm["name-server"].as<ns_endpoint_vec>(),
+            resolve_library, stub_config, vm["resolve-ipv6"].as<bool>());
+    resolver_bench bench(io, r, conf);
+    r.start();
+    bench.start();
+    io.run();
+
+    std::cout << "library\t" << library << "\n";
+    bench.report(std::cout);
+    return 0;
+}
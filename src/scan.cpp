@@ -0,0 +1,208 @@
+/*
+ * scan.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <cstring>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+#include "scan.hpp"
+
+namespace scan
+{
+
+static inline char lower(char c)
+{
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+static const char* find_scalar(const char* begin, const char* end, char c)
+{
+    const void* found = std::memchr(begin, c, end - begin);
+    return found ? static_cast<const char*>(found) : end;
+}
+
+static const char* find2_scalar(const char* begin, const char* end, char a, char b)
+{
+    for (; begin != end; ++begin)
+        if (*begin == a || *begin == b)
+            break;
+    return begin;
+}
+
+static std::size_t mismatch_nocase_scalar(const char* lhs, const char* rhs, std::size_t size)
+{
+    std::size_t i = 0;
+    while (i < size && lower(lhs[i]) == lower(rhs[i]))
+        ++i;
+    return i;
+}
+
+#ifdef SCAN_X86
+
+// ORs 0x20 into bytes 'A'..'Z', bytes above 0x7f are negative and stay
+__attribute__((target("sse2")))
+static inline __m128i fold_sse2(__m128i x)
+{
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('A' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), x));
+    return _mm_or_si128(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+__attribute__((target("sse2")))
+static const char* find_sse2(const char* begin, const char* end, char c)
+{
+    const __m128i needle = _mm_set1_epi8(c);
+    for (; end - begin >= 16; begin += 16)
+    {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        if (int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, needle)))
+            return begin + __builtin_ctz(mask);
+    }
+    return find2_scalar(begin, end, c, c);
+}
+
+__attribute__((target("sse2")))
+static const char* find2_sse2(const char* begin, const char* end, char a, char b)
+{
+    const __m128i needle_a = _mm_set1_epi8(a);
+    const __m128i needle_b = _mm_set1_epi8(b);
+    for (; end - begin >= 16; begin += 16)
+    {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+        __m128i found = _mm_or_si128(_mm_cmpeq_epi8(block, needle_a), _mm_cmpeq_epi8(block, needle_b));
+        if (int mask = _mm_movemask_epi8(found))
+            return begin + __builtin_ctz(mask);
+    }
+    return find2_scalar(begin, end, a, b);
+}
+
+__attribute__((target("sse2")))
+static std::size_t mismatch_nocase_sse2(const char* lhs, const char* rhs, std::size_t size)
+{
+    std::size_t i = 0;
+    for (; size - i >= 16; i += 16)
+    {
+        __m128i l = fold_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lhs + i)));
+        __m128i r = fold_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs + i)));
+        if (int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(l, r)) & 0xffff)
+            return i + __builtin_ctz(mask);
+    }
+    return i + mismatch_nocase_scalar(lhs + i, rhs + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i fold_avx2(__m256i x)
+{
+    __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8('A' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), x));
+    return _mm256_or_si256(x, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2")))
+static const char* find_avx2(const char* begin, const char* end, char c)
+{
+    const __m256i needle = _mm256_set1_epi8(c);
+    for (; end - begin >= 32; begin += 32)
+    {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        if (unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)))
+            return begin + __builtin_ctz(mask);
+    }
+    return find_sse2(begin, end, c);
+}
+
+__attribute__((target("avx2")))
+static const char* find2_avx2(const char* begin, const char* end, char a, char b)
+{
+    const __m256i needle_a = _mm256_set1_epi8(a);
+    const __m256i needle_b = _mm256_set1_epi8(b);
+    for (; end - begin >= 32; begin += 32)
+    {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+        __m256i found = _mm256_or_si256(_mm256_cmpeq_epi8(block, needle_a), _mm256_cmpeq_epi8(block, needle_b));
+        if (unsigned mask = _mm256_movemask_epi8(found))
+            return begin + __builtin_ctz(mask);
+    }
+    return find2_sse2(begin, end, a, b);
+}
+
+__attribute__((target("avx2")))
+static std::size_t mismatch_nocase_avx2(const char* lhs, const char* rhs, std::size_t size)
+{
+    std::size_t i = 0;
+    for (; size - i >= 32; i += 32)
+    {
+        __m256i l = fold_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(lhs + i)));
+        __m256i r = fold_avx2(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(rhs + i)));
+        if (unsigned mask = ~unsigned(_mm256_movemask_epi8(_mm256_cmpeq_epi8(l, r))))
+            return i + __builtin_ctz(mask);
+    }
+    return i + mismatch_nocase_sse2(lhs + i, rhs + i, size - i);
+}
+
+#endif
+
+static const implementation implementations[] =
+{
+    { &find_scalar, &find2_scalar, &mismatch_nocase_scalar },
+#ifdef SCAN_X86
+    { &find_sse2, &find2_sse2, &mismatch_nocase_sse2 },
+    { &find_avx2, &find2_avx2, &mismatch_nocase_avx2 },
+#endif
+};
+
+// scalar until static initialization below picks the best one
+implementation current = { &find_scalar, &find2_scalar, &mismatch_nocase_scalar };
+static level current_level = scalar;
+
+level supported_level()
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return avx2;
+    if (__builtin_cpu_supports("sse2"))
+        return sse2;
+#endif
+    return scalar;
+}
+
+// AVX2 is slower on header lines, which are mostly shorter than its 32 bytes
+level best_level()
+{
+    return std::min(supported_level(), sse2);
+}
+
+level get_level()
+{
+    return current_level;
+}
+
+void set_level(level l)
+{
+    current = implementations[l];
+    current_level = l;
+}
+
+const char* level_name(level l)
+{
+    static const char* const names[] = { "scalar", "sse2", "avx2" };
+    return names[l];
+}
+
+struct initializer
+{
+    initializer()
+    {
+        set_level(best_level());
+    }
+};
+
+static initializer init;
+
+}
@@ -0,0 +1,62 @@
+/*
+ * scan.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef SCAN_HPP_
+#define SCAN_HPP_
+
+#include <cstddef>
+
+// Delimiter search and case insensitive comparison of request header text,
+// 16 (SSE2) or 32 (AVX2) bytes at a time. Implementation is chosen at startup
+// from what CPU supports, other platforms use scalar one. AVX2 is only used by
+// benchmarks: setting up 32 byte blocks costs more than it saves on header lines.
+namespace scan
+{
+    enum level
+    {
+        scalar,
+        sse2,
+        avx2,
+    };
+
+    struct implementation
+    {
+        const char* (*find)(const char* begin, const char* end, char c);
+        const char* (*find2)(const char* begin, const char* end, char a, char b);
+        std::size_t (*mismatch_nocase)(const char* lhs, const char* rhs, std::size_t size);
+    };
+
+    extern implementation current;
+
+    // highest level supported by CPU
+    level supported_level();
+    // fastest level supported by CPU, which is used unless set_level is called
+    level best_level();
+    level get_level();
+    // for benchmarks, level must be supported by CPU
+    void set_level(level l);
+    const char* level_name(level l);
+
+    // first c in [begin, end) or end
+    inline const char* find(const char* begin, const char* end, char c)
+    {
+        return current.find(begin, end, c);
+    }
+
+    // first a or b in [begin, end) or end
+    inline const char* find2(const char* begin, const char* end, char a, char b)
+    {
+        return current.find2(begin, end, a, b);
+    }
+
+    // index of the first byte which differs ignoring ASCII case, size if none does
+    inline std::size_t mismatch_nocase(const char* lhs, const char* rhs, std::size_t size)
+    {
+        return current.mismatch_nocase(lhs, rhs, size);
+    }
+}
+
+#endif /* SCAN_HPP_ */
@@ -5,29 +5,114 @@
  *      Author: nbryskin
  */
 
+#include <unistd.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <cstring>
 #include <functional>
 #include <algorithm>
 #include <boost/bind.hpp>
-#include <boost/lambda/lambda.hpp>
 
 #include "session.hpp"
 #include "proxy.hpp"
 #include "statistics.hpp"
-#include "headers.hpp"
+#include "header_table.hpp"
+#include "peer_scores.hpp"
+#include "hosts_file.hpp"
+#include "scan.hpp"
 
 logger session::log = logger(keywords::channel = "session");
 
+static const statistics::counter total_sessions_stat("total_sessions");
+static const statistics::counter current_sessions_stat("current_sessions");
+static const statistics::counter channel_time_stat("channel_time", statistics::seconds);
+static const statistics::counter session_time_stat("session_time", statistics::seconds);
+static const statistics::counter finished_sessions_stat("finished_sessions");
+static const statistics::counter failed_sessions_stat("failed_sessions");
+static const statistics::counter request_header_time_stat("request_header_time", statistics::seconds);
+static const statistics::counter header_resumes_stat("header_resumes");
+static const statistics::counter header_grown_stat("header_grown");
+static const statistics::counter header_too_large_stat("header_too_large");
+static const statistics::counter resolve_failed_stat("resolve_failed");
+static const statistics::counter resolve_time_stat("resolve_time", statistics::seconds);
+static const statistics::counter hosts_hits_stat("hosts_hits");
+static const statistics::counter send_error_failed_stat("send_error_failed");
+static const statistics::counter connect_failed_stat("connect_failed");
+static const statistics::counter connect_attempts_stat("connect_attempts");
+static const statistics::counter connect_race_won_stat("connect_race_won");
+static const statistics::counter connected_time_stat("connected_time", statistics::seconds);
+static const statistics::counter send_request_header_time_stat("send_request_header_time", statistics::seconds);
+static const statistics::counter send_connect_response_time_stat("send_connect_response_time", statistics::seconds);
+static const statistics::counter framed_requests_stat("framed_requests");
+static const statistics::counter keep_alive_requests_stat("keep_alive_requests");
+static const statistics::counter response_spliced_stat("response_spliced");
+static const statistics::counter response_failed_stat("response_failed");
+
+// shorter bodies and chunks are received and sent by session
+static const std::uint64_t min_splice_size = 16384;
+
 session::session(asio::io_service& io, proxy& parent_proxy)
     : parent_proxy(parent_proxy), requester(io), responder(io)
-    , request_channel(requester, responder, *this, parent_proxy.get_receive_timeout())
-    , response_channel(responder, requester, *this, parent_proxy.get_receive_timeout(), /*first_input_stat=*/true)
+    , request_channel(requester, responder, *this, parent_proxy.get_timing_wheel(), parent_proxy.get_receive_timeout(), parent_proxy.get_splice_budget(), parent_proxy.get_uring())
+    , response_channel(responder, requester, *this, parent_proxy.get_timing_wheel(), parent_proxy.get_receive_timeout(), parent_proxy.get_splice_budget(), parent_proxy.get_uring(), /*first_input_stat=*/true)
+    , header_size(0)
+    , header_capacity(header_data.size())
+    , client_keep_alive(parent_proxy.get_client_keep_alive())
+    , keep_alive(false)
+    , requests(0)
+    , request_end(0)
+    , response_begin(0)
+    , response_size(0)
+    , response_scanned(0)
+    , response_parsed(0)
+    , response_sent(0)
+    , response_header_received(false)
+    , response_interim(false)
+    , response_upgrade(false)
+    , response_close(false)
     , opened_channels(2)
     , resolve_handler(boost::bind(&session::finished_resolving, this, placeholders::error(), _2, _3))
     , connect_timeout(parent_proxy.get_connect_timeout())
     , resolve_timeout(parent_proxy.get_resolve_timeout())
-    , timeout_timer(io)
+    , connect_attempt_delay(parent_proxy.get_connect_attempt_delay())
+    , wheel(parent_proxy.get_timing_wheel())
+    , peers_count(0)
+    , next_peer(0)
+    , pending_attempts(0)
+    , finishing(false)
+    , connected(false)
+    , connect_expired(false)
     , resolveid()
+    , ring(parent_proxy.get_uring())
+{
+    header_begin = header_data.begin();
+    attempt_timer.set_handler(boost::bind(&session::finished_waiting_attempt_timer, this));
+#ifdef HAVE_IO_URING
+    connect_op.set_handler(boost::bind(&session::finished_ring_connect, this, _1));
+#endif
+}
+
+session::~session()
+{
+    if (header_begin != header_data.begin())
+        parent_proxy.get_header_pool().deallocate(header_begin);
+    if (response_begin)
+        parent_proxy.get_header_pool().deallocate(response_begin);
+}
+
+void* session::operator new(std::size_t size, session_pool& pool)
+{
+    return pool.allocate(size);
+}
+
+void session::operator delete(void* ptr, session_pool&)
+{
+    session_pool::deallocate(ptr);
+}
+
+void session::operator delete(void* ptr)
 {
+    session_pool::deallocate(ptr);
 }
 
 ip::tcp::socket& session::socket()
@@ -38,8 +123,9 @@ ip::tcp::socket& session::socket()
 void session::start()
 {
     timer.restart();
-    statistics::increment("total_sessions");
-    statistics::increment("current_sessions");
+    request_timer.restart();
+    statistics::increment(total_sessions_stat);
+    statistics::increment(current_sessions_stat);
     requester.set_option(asio::ip::tcp::no_delay(true));
     start_receive_header();
 }
@@ -56,24 +142,38 @@ void session::finished_channel(const error_code& ec)
         prev_ec = ec;
         if (ec)
         {
+            request_channel.cancel();
+            response_channel.cancel();
             error_code tmp_ec;
             requester.close(tmp_ec);
             responder.close(tmp_ec);
             requester.cancel(tmp_ec);
             responder.cancel(tmp_ec);
         }
-        statistics::increment("channel_time", timer.elapsed());
+        statistics::increment(channel_time_stat, request_timer.elapsed());
     }
 }
 
 void session::finish(const error_code& ec)
 {
-    statistics::increment("session_time", timer.elapsed());
-    statistics::decrement("current_sessions");
-    statistics::increment("finished_sessions");
+    // connection attempts which lost the race still refer to session, the last of them finishes it
+    if (pending_attempts != 0)
+    {
+        finishing = true;
+        finish_ec = ec;
+        wheel.cancel(timeout_timer);
+        wheel.cancel(attempt_timer);
+        // losers are closed already when some attempt won
+        if (!connected)
+            close_connect_attempts(peers_count);
+        return;
+    }
+    statistics::increment(session_time_stat, timer.elapsed());
+    statistics::decrement(current_sessions_stat);
+    statistics::increment(finished_sessions_stat);
     if (ec && ec != asio::error::eof)
     {
-        statistics::increment("failed_sessions");
+        statistics::increment(failed_sessions_stat);
         BOOST_LOG_SEV(log, severity_level::error) << system_error(ec).what();
     }
     parent_proxy.finished_session(this, ec);
@@ -81,45 +181,98 @@ void session::finish(const error_code& ec)
 
 void session::start_receive_header()
 {
-    requester.async_receive(asio::buffer(header_data), boost::bind(&session::finished_receive_header, this,
+    // last byte is left for zero put by parse_header
+    requester.async_receive(asio::buffer(header_begin + header_size, header_capacity - header_size - 1), boost::bind(&session::finished_receive_header, this,
             placeholders::error(), placeholders::bytes_transferred));
 }
 
 void session::finished_receive_header(const error_code& ec, std::size_t bytes_transferred)
 {
-    statistics::increment("request_header_time", timer.elapsed());
-    TRACE_ERROR(ec);
+    TRACE_ERROR(ec) << bytes_transferred;
+    if (requests > 0)
+        wheel.cancel(timeout_timer);
+    // client closing idle keep-alive connection or not using it in time is fine
     if (ec)
-        return finish(ec);
-    const char* dn = parse_header(bytes_transferred);
+        return finish(requests > 0 && header_size == 0 ? error_code() : ec);
+
+    std::size_t scanned = header_size;
+    header_size += bytes_transferred;
+    if (requests > 0 && skip_empty_lines())
+        scanned = 0;
+    // header ends with "\n\n" or "\n\r\n", which may start in bytes scanned before
+    const char* header_end = find_header_end(header_begin + (scanned < 2 ? 0 : scanned - 2), header_begin + header_size);
+    if (!header_end)
+    {
+        if (header_size == header_capacity - 1 && !grow_header())
+        {
+            statistics::increment(header_too_large_stat);
+            return start_sending_error(HTTP_500);
+        }
+        statistics::increment(header_resumes_stat);
+        if (requests > 0)
+            start_waiting_receive_timer();
+        return start_receive_header();
+    }
+    finished_header(header_end);
+}
+
+void session::finished_header(const char* header_end)
+{
+    if (requests > 0)
+        statistics::increment(keep_alive_requests_stat);
+    statistics::increment(request_header_time_stat, request_timer.elapsed());
+    const char* dn = parse_header(header_size);
+    frame_request(header_end);
     error_code convert_ec;
     const ip::address& peer_addr = ip::address::from_string(dn, convert_ec);
-    if (convert_ec)
-        start_resolving(dn);
-    else
-        start_connecting_to_peer(ip::tcp::endpoint(peer_addr, port));
+    if (!convert_ec)
+        return start_connecting(&peer_addr, &peer_addr + 1);
+
+    if (hosts_file* hosts = hosts_file::instance())
+    {
+        // table is held until addresses are copied to peers
+        std::shared_ptr<const hosts_table> table = hosts->table();
+        hosts_table::range addresses = table->find(dn);
+        if (addresses.first != addresses.second)
+        {
+            statistics::increment(hosts_hits_stat);
+            return start_connecting(addresses.first, addresses.second);
+        }
+    }
+    start_resolving(dn);
+}
+
+bool session::grow_header()
+{
+    header_pool& buffers = parent_proxy.get_header_pool();
+    if (header_begin != header_data.begin() || buffers.buffer_size() <= header_capacity)
+        return false;
+
+    statistics::increment(header_grown_stat);
+    header_begin = buffers.allocate();
+    header_capacity = buffers.buffer_size();
+    std::memcpy(header_begin, header_data.begin(), header_size);
+    return true;
 }
 
 void session::start_resolving(const char* peer)
 {
     TRACE() << peer << ":" << port;
-    resolveid = parent_proxy.get_resolver().async_resolve(peer, resolve_handler);
+    // cached name is resolved at once, so timer is armed first
     start_waiting_resolve_timer();
+    resolveid = parent_proxy.get_resolver().async_resolve(peer, resolve_handler);
 }
 
 void session::start_waiting_resolve_timer()
 {
     TRACE();
-    timeout_timer.expires_from_now(asio::deadline_timer::duration_type(0, 0, resolve_timeout.seconds()));
-    timeout_timer.async_wait(boost::bind(&session::finished_waiting_resolve_timer, this, placeholders::error));
+    timeout_timer.set_handler(boost::bind(&session::finished_waiting_resolve_timer, this));
+    wheel.schedule(timeout_timer, resolve_timeout);
 }
 
-void session::finished_waiting_resolve_timer(const error_code& ec)
+void session::finished_waiting_resolve_timer()
 {
-    TRACE_ERROR(ec);
-    if (ec)
-        return;
-
+    TRACE();
     if (parent_proxy.get_resolver().cancel(resolveid) == 0) {
         finished_resolving(boost::system::errc::make_error_code(boost::system::errc::timed_out), 0, 0);
     }
@@ -129,34 +282,32 @@ void session::finished_resolving(const error_code& ec, resolver::iterator begin,
 {
     TRACE_ERROR(ec);
 
-    timeout_timer.cancel();
+    wheel.cancel(timeout_timer);
 
     if (ec)
     {
-        statistics::increment("resolve_failed");
+        statistics::increment(resolve_failed_stat);
         start_sending_error(HTTP_503);
         return;
     }
-    statistics::increment("resolve_time", timer.elapsed());
-    // TODO: cycle throw all addresses
-    start_connecting_to_peer(ip::tcp::endpoint(*begin, port));
-    start_waiting_connect_timer();
+    statistics::increment(resolve_time_stat, request_timer.elapsed());
+    start_connecting(begin, end);
 }
 
 void session::start_waiting_connect_timer()
 {
     TRACE();
-    timeout_timer.expires_from_now(asio::deadline_timer::duration_type(0, 0, connect_timeout.seconds()));
-    timeout_timer.async_wait(boost::bind(&session::finished_waiting_connect_timer, this, placeholders::error));
+    timeout_timer.set_handler(boost::bind(&session::finished_waiting_connect_timer, this));
+    wheel.schedule(timeout_timer, connect_timeout);
 }
 
-void session::finished_waiting_connect_timer(const error_code& ec)
+void session::finished_waiting_connect_timer()
 {
-    TRACE_ERROR(ec);
-    if (ec)
-        return;
-
-    responder.cancel();
+    TRACE();
+    // attempts in flight complete with operation_aborted
+    connect_expired = true;
+    wheel.cancel(attempt_timer);
+    close_connect_attempts(peers_count);
 }
 
 void session::start_sending_error(http_error_code httpec)
@@ -168,37 +319,185 @@ void session::finished_sending_error(const error_code& ec, std::size_t bytes_tra
 {
     TRACE_ERROR(ec);
     if (ec)
-        statistics::increment("send_error_failed");
+        statistics::increment(send_error_failed_stat);
     finish(ec);
 }
 
-void session::start_connecting_to_peer(const ip::tcp::endpoint& peer)
+void session::start_connecting(resolver::iterator begin, resolver::iterator end)
 {
-    TRACE() << peer;
+    // addresses of each family are ordered by score on their own, then families
+    // alternate starting with family of the first address, so scoring never
+    // groups one family ahead of the other
+    ip::address family[2][dns_cache::max_addresses];
+    std::size_t family_count[2] = { 0, 0 };
+    for (resolver::iterator it = begin; it != end; ++it)
+    {
+        bool v6 = it->is_v6();
+        if (family_count[v6] < dns_cache::max_addresses)
+            family[v6][family_count[v6]++] = *it;
+    }
+    if (peer_scores* scores = peer_scores::instance())
+    {
+        scores->order(family[false], family[false] + family_count[false]);
+        scores->order(family[true], family[true] + family_count[true]);
+    }
+
+    std::size_t taken[2] = { 0, 0 };
+    bool v6 = begin->is_v6();
+    peers_count = 0;
+    while (peers_count < dns_cache::max_addresses && (taken[false] < family_count[false] || taken[true] < family_count[true]))
+    {
+        if (taken[v6] < family_count[v6])
+            peers[peers_count++] = family[v6][taken[v6]++];
+        v6 = !v6;
+    }
+
+    next_peer = 0;
+    start_waiting_connect_timer();
+    start_connect_attempt();
+}
+
+void session::start_connect_attempt()
+{
+    std::size_t attempt = next_peer++;
+    ip::tcp::endpoint peer(peers[attempt], port);
+    TRACE() << attempt << " " << peer;
+    ++pending_attempts;
+    attempt_started[attempt] = request_timer.elapsed();
+    statistics::increment(connect_attempts_stat);
+
+    ip::tcp::socket& s = attempt_socket(attempt);
     try
     {
-        responder.open(peer.protocol());
-        responder.bind(parent_proxy.get_outgoing_endpoint());
+        s.open(peer.protocol());
+        s.bind(parent_proxy.get_outgoing_endpoint(peer.protocol()));
+        if (ring)
+        {
+            // ring splices must not block io_uring workers
+            asio::socket_base::non_blocking_io non_blocking(true);
+            s.io_control(non_blocking);
+        }
     }
     catch (const boost::system::system_error& e)
     {
         TRACE_ERROR(e.code());
-        return finish(e.code());
+        return finished_connect_attempt(e.code(), attempt);
+    }
+
+    if (next_peer < peers_count)
+        wheel.schedule(attempt_timer, connect_attempt_delay);
+#ifdef HAVE_IO_URING
+    // connect timeout is enforced by timeout_timer for all attempts
+    if (ring && attempt == 0)
+        return ring->async_connect(s.native(), peer, time_duration(), connect_op);
+#endif
+    s.async_connect(peer, boost::bind(&session::finished_connect_attempt, this, placeholders::error(), attempt));
+}
+
+void session::finished_connect_attempt(const error_code& ec, std::size_t attempt)
+{
+    TRACE_ERROR(ec) << attempt;
+    --pending_attempts;
+    if (finishing)
+    {
+        if (pending_attempts == 0)
+            finish(finish_ec);
+        return;
+    }
+    // attempt which lost the race
+    if (connected)
+        return;
+
+    peer_scores* scores = peer_scores::instance();
+    error_code tmp_ec;
+    if (ec)
+    {
+        // attempts aborted by connect timeout are failures too
+        if (scores && (ec != asio::error::operation_aborted || connect_expired))
+            scores->failed(peers[attempt]);
+        attempt_socket(attempt).close(tmp_ec);
+        if (ec != asio::error::operation_aborted || !connect_ec)
+            connect_ec = ec;
+        if (!connect_expired && next_peer < peers_count)
+            return start_connect_attempt();
+        if (pending_attempts == 0 && (connect_expired || next_peer == peers_count))
+            finished_connecting_to_peer(connect_ec);
+        return;
+    }
+
+    connected = true;
+    if (scores)
+        scores->connected(peers[attempt], request_timer.elapsed() - attempt_started[attempt]);
+    wheel.cancel(attempt_timer);
+    close_connect_attempts(attempt);
+    if (attempt != 0)
+    {
+        statistics::increment(connect_race_won_stat);
+        // winning descriptor replaces responder, channels are bound to it
+        ip::tcp::socket& winner = racers[attempt - 1];
+        int fd = dup(winner.native());
+        winner.close(tmp_ec);
+        if (fd == -1)
+            return finished_connecting_to_peer(error_code(errno, boost::system::get_system_category()));
+
+        error_code assign_ec;
+        responder.assign(ip::tcp::endpoint(peers[attempt], port).protocol(), fd, assign_ec);
+        if (assign_ec)
+        {
+            close(fd);
+            return finished_connecting_to_peer(assign_ec);
+        }
+        if (ring)
+        {
+            asio::socket_base::non_blocking_io non_blocking(true);
+            responder.io_control(non_blocking, tmp_ec);
+        }
+    }
+    finished_connecting_to_peer(ec);
+}
+
+void session::finished_waiting_attempt_timer()
+{
+    TRACE() << next_peer;
+    if (!connected && !connect_expired && next_peer < peers_count)
+        start_connect_attempt();
+}
+
+ip::tcp::socket& session::attempt_socket(std::size_t attempt)
+{
+    if (attempt == 0)
+        return responder;
+    while (racers.size() < attempt)
+        racers.push_back(new ip::tcp::socket(responder.get_io_service()));
+    return racers[attempt - 1];
+}
+
+void session::close_connect_attempts(std::size_t winner)
+{
+    error_code tmp_ec;
+    for (std::size_t attempt = 0; attempt < next_peer; ++attempt)
+    {
+        if (attempt == winner)
+            continue;
+#ifdef HAVE_IO_URING
+        if (ring && attempt == 0)
+            ring->cancel(connect_op);
+#endif
+        attempt_socket(attempt).close(tmp_ec);
     }
-    responder.async_connect(peer, boost::bind(&session::finished_connecting_to_peer, this, placeholders::error()));
 }
 
 void session::finished_connecting_to_peer(const error_code& ec)
 {
     TRACE_ERROR(ec);
-    timeout_timer.cancel();
+    wheel.cancel(timeout_timer);
     if (ec)
     {
-        statistics::increment("connect_failed");
+        statistics::increment(connect_failed_stat);
         start_sending_error(HTTP_504);
         return;
     }
-    statistics::increment("connected_time", timer.elapsed());
+    statistics::increment(connected_time_stat, request_timer.elapsed());
     switch (method)
     {
         case CONNECT:
@@ -210,20 +509,42 @@ void session::finished_connecting_to_peer(const error_code& ec)
     }
 }
 
+#ifdef HAVE_IO_URING
+void session::finished_ring_connect(int result)
+{
+    error_code ec;
+    // canceled when connect timeout expires or another attempt wins
+    if (result == -ECANCELED)
+        ec = asio::error::operation_aborted;
+    else if (result < 0)
+        ec = error_code(-result, boost::system::get_system_category());
+    finished_connect_attempt(ec, 0);
+}
+#endif
+
 void session::start_sending_header()
 {
     prepare_header();
     process_headers();
-    responder.async_send(output_headers, boost::bind(&session::finished_sending_header, this, placeholders::error()));
+    // framed request body must not be left behind
+    asio::async_write(responder, output_headers, boost::bind(&session::finished_sending_header, this, placeholders::error()));
 }
 
 void session::finished_sending_header(const error_code& ec)
 {
-    statistics::increment("send_request_header_time", timer.elapsed());
+    statistics::increment(send_request_header_time_stat, request_timer.elapsed());
     TRACE_ERROR(ec);
     if (ec)
         return finish(ec);
-    start_channels();
+    if (!keep_alive)
+        return start_channels();
+
+    if (std::uint64_t size = request_body.spliceable())
+    {
+        opened_channels = 1;
+        return request_channel.start(long(size));
+    }
+    start_receive_response();
 }
 
 void session::start_sending_connect_response()
@@ -234,7 +555,7 @@ void session::start_sending_connect_response()
 
 void session::finished_sending_connect_response(const error_code& ec)
 {
-    statistics::increment("send_connect_response_time", timer.elapsed());
+    statistics::increment(send_connect_response_time_stat, request_timer.elapsed());
     TRACE_ERROR(ec);
     if (ec)
         return finish(ec);
@@ -244,28 +565,277 @@ void session::finished_sending_connect_response(const error_code& ec)
 
 void session::start_channels()
 {
+    opened_channels = 2;
     request_channel.start();
     response_channel.start();
 }
 
+void session::finished_channel_limit(const channel& c)
+{
+    TRACE() << (&c == &request_channel ? "request" : "response");
+    if (&c == &request_channel)
+    {
+        request_body.spliced(request_body.spliceable());
+        return start_receive_response();
+    }
+    response_body.spliced(response_body.spliceable());
+    continue_response();
+}
+
+void session::frame_request(const char* header_end)
+{
+    keep_alive = false;
+    if (!client_keep_alive || method == CONNECT)
+        return;
+
+    // request line is after resource in headers_tail
+    const char* tail = asio::buffer_cast<const char*>(headers_tail);
+    const char* line_end = scan::find(tail + 1, header_end, '\n');
+    message_fields fields;
+    fields.parse(line_end + 1, header_end);
+    // request which is the last one or whose body can not be counted is tunneled,
+    // so is one expecting 100-continue: its body is sent after response starts
+    if (fields.close || (is_http10_line(tail + 1, line_end) && !fields.keep_alive) || fields.upgrade || fields.expect
+            || fields.chunked || fields.bad_length)
+        return;
+
+    statistics::increment(framed_requests_stat);
+    keep_alive = true;
+    request_body.start_length(fields.has_length ? fields.length : 0);
+    // body bytes received with header are sent with it, bytes after it belong to next request
+    const char* end = header_end + request_body.consume(header_end, header_begin + header_size);
+    request_end = end - header_begin;
+    headers_tail = asio::const_buffer(tail, end - tail);
+}
+
+void session::start_receive_response()
+{
+    if (!response_begin)
+        response_begin = parent_proxy.get_header_pool().allocate();
+    response_size = response_scanned = response_parsed = response_sent = 0;
+    response_header_received = false;
+    start_waiting_receive_timer();
+    responder.async_receive(asio::buffer(response_begin, parent_proxy.get_header_pool().buffer_size()), boost::bind(&session::finished_receive_response, this,
+            placeholders::error(), placeholders::bytes_transferred));
+}
+
+void session::finished_receive_response(const error_code& ec, std::size_t bytes_transferred)
+{
+    TRACE_ERROR(ec) << bytes_transferred;
+    wheel.cancel(timeout_timer);
+    if (ec)
+        return fail_response(ec);
+    response_size += bytes_transferred;
+    continue_response();
+}
+
+void session::continue_response()
+{
+    std::size_t capacity = parent_proxy.get_header_pool().buffer_size();
+    if (!response_header_received)
+    {
+        // header ends with "\n\n" or "\n\r\n", which may start in bytes scanned before
+        std::size_t from = std::max(response_parsed, response_scanned < 2 ? 0 : response_scanned - 2);
+        const char* header_end = find_header_end(response_begin + from, response_begin + response_size);
+        response_scanned = response_size;
+        if (header_end)
+        {
+            if (!frame_response(response_begin + response_parsed, header_end))
+                return fail_response(asio::error::make_error_code(asio::error::invalid_argument));
+            response_header_received = true;
+            response_parsed = header_end - response_begin;
+        }
+        else if (response_parsed == 0 && response_size == capacity)
+        {
+            return fail_response(asio::error::make_error_code(asio::error::message_size));
+        }
+    }
+    if (response_header_received)
+        response_parsed += response_body.consume(response_begin + response_parsed, response_begin + response_size);
+
+    if (response_parsed > response_sent)
+    {
+        return requester.async_send(asio::buffer(response_begin + response_sent, response_parsed - response_sent),
+                boost::bind(&session::finished_sending_response, this, placeholders::error(), placeholders::bytes_transferred));
+    }
+    if (response_body.failed())
+        return fail_response(asio::error::make_error_code(asio::error::invalid_argument));
+    if (response_header_received && response_body.complete())
+    {
+        if (!response_interim)
+            return finished_response();
+        // final response follows
+        response_header_received = false;
+        response_scanned = response_parsed;
+        return continue_response();
+    }
+
+    std::uint64_t size = response_header_received ? response_body.spliceable() : 0;
+    if (size >= min_splice_size)
+    {
+        // whole buffer is sent, rest of body goes around it
+        statistics::increment(response_spliced_stat);
+        response_size = response_scanned = response_parsed = response_sent = 0;
+        if (response_upgrade)
+            return start_channels();
+        opened_channels = 1;
+        return response_channel.start(size == body_framing::unlimited ? channel::unlimited : long(size));
+    }
+
+    // bytes not parsed yet are moved to the beginning of buffer if it is full
+    if (response_parsed == response_size || response_size == capacity)
+    {
+        std::memmove(response_begin, response_begin + response_parsed, response_size - response_parsed);
+        response_size -= response_parsed;
+        response_scanned -= std::min(response_scanned, response_parsed);
+        response_sent = response_parsed = 0;
+    }
+    if (response_size == capacity)
+        return fail_response(asio::error::make_error_code(asio::error::message_size));
+
+    start_waiting_receive_timer();
+    responder.async_receive(asio::buffer(response_begin + response_size, capacity - response_size), boost::bind(&session::finished_receive_response, this,
+            placeholders::error(), placeholders::bytes_transferred));
+}
+
+bool session::frame_response(const char* begin, const char* header_end)
+{
+    const char* line_end = scan::find(begin, header_end, '\n');
+    int status = parse_status(begin, line_end);
+    TRACE() << status;
+    if (status == 0)
+        return false;
+
+    message_fields fields;
+    fields.parse(line_end + 1, header_end);
+    response_close = fields.close || (is_http10_line(begin, line_end) && !fields.keep_alive);
+    response_interim = status < 200 && status != 101;
+    response_upgrade = status == 101;
+    // RFC 7230 3.3.3, connection switched to other protocol is tunneled
+    if (response_upgrade)
+        response_body.start_until_close();
+    else if (status < 200 || method == HEAD || status == 204 || status == 304)
+        response_body.start_length(0);
+    else if (fields.chunked)
+        response_body.start_chunked();
+    else if (fields.has_length && !fields.bad_length)
+        response_body.start_length(fields.length);
+    else
+    {
+        response_body.start_until_close();
+        response_close = true;
+    }
+    return true;
+}
+
+void session::finished_sending_response(const error_code& ec, std::size_t bytes_transferred)
+{
+    TRACE_ERROR(ec) << bytes_transferred;
+    if (ec)
+        return finish(ec);
+    response_sent += bytes_transferred;
+    continue_response();
+}
+
+void session::finished_response()
+{
+    TRACE() << requests;
+    ++requests;
+    // connection attempts which lost the race are not finished yet, they are not mixed with next request's ones
+    if (response_close || pending_attempts != 0)
+        return finish(error_code());
+
+    // upstream connection is not reused, next request may go to another host
+    error_code tmp_ec;
+    responder.close(tmp_ec);
+    connected = false;
+    connect_expired = false;
+    connect_ec = error_code();
+    parent_proxy.get_header_pool().deallocate(response_begin);
+    response_begin = 0;
+    start_next_request();
+}
+
+void session::fail_response(const error_code& ec)
+{
+    TRACE_ERROR(ec);
+    statistics::increment(response_failed_stat);
+    if (response_sent == 0 && !response_header_received)
+        return start_sending_error(ec == asio::error::operation_aborted ? HTTP_504 : HTTP_502);
+    finish(ec);
+}
+
+void session::start_next_request()
+{
+    request_timer.restart();
+    // pipelined request may follow previous one
+    header_size -= request_end;
+    std::memmove(header_begin, header_begin + request_end, header_size);
+    skip_empty_lines();
+    if (header_begin != header_data.begin() && header_size < header_data.size())
+    {
+        std::memcpy(header_data.begin(), header_begin, header_size);
+        parent_proxy.get_header_pool().deallocate(header_begin);
+        header_begin = header_data.begin();
+        header_capacity = header_data.size();
+    }
+    request_end = 0;
+    output_headers.clear();
+
+    if (const char* header_end = find_header_end(header_begin, header_begin + header_size))
+        return finished_header(header_end);
+    start_waiting_receive_timer();
+    start_receive_header();
+}
+
+bool session::skip_empty_lines()
+{
+    std::size_t skip = 0;
+    while (skip < header_size && (header_begin[skip] == '\r' || header_begin[skip] == '\n'))
+        ++skip;
+    if (skip == 0)
+        return false;
+    header_size -= skip;
+    std::memmove(header_begin, header_begin + skip, header_size);
+    return true;
+}
+
+void session::start_waiting_receive_timer()
+{
+    TRACE();
+    timeout_timer.set_handler(boost::bind(&session::finished_waiting_receive_timer, this));
+    wheel.schedule(timeout_timer, parent_proxy.get_receive_timeout());
+}
+
+void session::finished_waiting_receive_timer()
+{
+    TRACE();
+    // pending receive completes with operation_aborted
+    error_code tmp_ec;
+    requester.cancel(tmp_ec);
+    responder.cancel(tmp_ec);
+}
+
 const char* session::parse_header(std::size_t size)
 {
     // it could be GET http://ya.ru HTTP/1.0
     //          or GET http://ya.ru/index.html HTTP/1.0
-    using boost::lambda::_1;
-    char* begin = header_data.begin();
+    char* begin = header_begin;
     char* end = begin + size;
-    char* method_end = std::find(begin, end, ' ');
+    char* method_end = const_cast<char*>(scan::find(begin, end, ' '));
+    static const char head[] = "HEAD";
     if (std::mismatch(begin, method_end, "CONNECT").first == method_end)
         method = CONNECT;
+    else if (method_end - begin == sizeof(head) - 1 && std::equal(begin, method_end, head))
+        method = HEAD;
     else
         method = OTHER;
     char* url = method_end + 1;
-    output_headers.push_back(asio::const_buffer(header_data.begin(), url - header_data.begin()));
+    output_headers.push_back(asio::const_buffer(header_begin, url - header_begin));
 
     char* dn_begin = url + (method == CONNECT ? 0 : sizeof("http://") - 1);
-    char* dn_end = std::find_if(dn_begin, end, _1 == ' ' || _1 == '/');
-    char* colon = std::find(dn_begin, dn_end, ':');
+    char* dn_end = const_cast<char*>(scan::find2(dn_begin, end, ' ', '/'));
+    char* colon = const_cast<char*>(scan::find(dn_begin, dn_end, ':'));
     char* resource = *dn_end == '/' ? dn_end : dn_end - 1;
     // it should be GET http://ya.ru\0HTTP/1.0
     //                             ^-resource
@@ -295,14 +865,29 @@ void session::prepare_header()
 
 lstring get_next_header(const lstring& headers, const lstring& current)
 {
-    const char* header = std::find(current.end, headers.end, '\n');
-    return lstring(current.end, header + 1);
+    const char* header = scan::find(current.end, headers.end, '\n');
+    return lstring(current.end, header == headers.end ? header : header + 1);
+}
+
+// whether request line ends with HTTP/1.0
+bool is_http10(const lstring& request_line)
+{
+    static const char http10[] = "HTTP/1.0";
+    const std::size_t size = sizeof(http10) - 1;
+    const char* version_end = request_line.end - (request_line.size() > 1 && request_line.end[-2] == '\r' ? 2 : 1);
+    return version_end - request_line.begin >= std::ptrdiff_t(size) && std::equal(http10, http10 + size, version_end - size);
+}
+
+// empty line ends headers, there is one in complete header
+bool is_last_header(const lstring& header)
+{
+    return header.empty() || *header.begin == '\r' || *header.begin == '\n';
 }
 
 void session::process_headers()
 {
-    const headers_type& allowed_headers = parent_proxy.get_allowed_headers();
-    if (allowed_headers.empty())
+    const header_table& table = parent_proxy.get_allowed_headers();
+    if (table.empty())
     {
         output_headers.push_back(headers_tail);
         return;
@@ -315,32 +900,90 @@ void session::process_headers()
     // The first line is request itself, it has to be passed as is
     header = get_next_header(headers, header);
     output_headers.push_back(asio::const_buffer(header.begin, header.size()));
+    const lstring request_line = header;
 
     // Request line is followed by headers, process header lines one-by-one till the first empty line
-    for (header = get_next_header(headers, header); !header.empty(); header = get_next_header(headers, header))
+    for (header = get_next_header(headers, header); !is_last_header(header); header = get_next_header(headers, header))
     {
-        std::map<lstring, lstring>::const_iterator entry = allowed_headers.find(header);
-        if (entry != allowed_headers.end())
+        const header_table::entry* entry = table.find(header.begin, header.end);
+        if (!entry)
         {
-            if (entry->second.empty())
-            {
-                // Just passthrough allowed header
+            // Headers missing from table are passed unless table allows headers
+            if (!table.filter())
                 output_headers.push_back(asio::const_buffer(header.begin, header.size()));
-            }
-            else
-            {
-                // Replace found header name with the new one...
-                output_headers.push_back(asio::const_buffer(entry->second.begin, entry->second.size()));
-                // ...and leave its value as-is.
-                output_headers.push_back(asio::const_buffer(header.begin + entry->first.size(), header.size() - entry->first.size()));
-            }
+        }
+        else if (entry->drop)
+        {
+            // Value is set by one of added lines
+            continue;
+        }
+        else if (entry->replacement.empty())
+        {
+            // Just passthrough allowed header
+            output_headers.push_back(asio::const_buffer(header.begin, header.size()));
+        }
+        else
+        {
+            // Replace found header name with the new one...
+            output_headers.push_back(asio::const_buffer(entry->replacement.begin, entry->replacement.size()));
+            // ...and leave its value as-is.
+            output_headers.push_back(asio::const_buffer(header.begin + entry->name.size(), header.size() - entry->name.size()));
         }
     }
 
+    // Lines added by rules go before the empty line, they are static except
+    // client address. Several lines of a header are equal to one line with
+    // comma separated values, so lines of previous proxies are kept.
+    const std::vector<lstring>& added = table.added();
+    for (std::size_t i = 0; i < added.size(); ++i)
+        output_headers.push_back(asio::const_buffer(added[i].begin, added[i].size()));
+    const lstring& forwarded_for = table.forwarded_for();
+    if (!forwarded_for.empty())
+    {
+        if (std::size_t size = format_forwarded_for())
+        {
+            output_headers.push_back(asio::const_buffer(forwarded_for.begin, forwarded_for.size()));
+            output_headers.push_back(asio::const_buffer(forwarded_for_data.data(), size));
+        }
+    }
+    const lstring& via = table.via(is_http10(request_line));
+    if (!via.empty())
+        output_headers.push_back(asio::const_buffer(via.begin, via.size()));
+
     // Copy everything left beyond headers
     output_headers.push_back(asio::const_buffer(header.begin, headers.end - header.begin));
 }
 
+std::size_t session::format_forwarded_for()
+{
+    error_code ec;
+    ip::address address = requester.remote_endpoint(ec).address();
+    TRACE_ERROR(ec);
+    if (ec)
+        return 0;
+    if (address.is_v6() && address.to_v6().is_v4_mapped())
+        address = address.to_v6().to_v4();
+
+    char* data = forwarded_for_data.data();
+    const char* formatted;
+    if (address.is_v4())
+    {
+        ip::address_v4::bytes_type bytes = address.to_v4().to_bytes();
+        formatted = inet_ntop(AF_INET, bytes.data(), data, forwarded_for_data.size() - 2);
+    }
+    else
+    {
+        ip::address_v6::bytes_type bytes = address.to_v6().to_bytes();
+        formatted = inet_ntop(AF_INET6, bytes.data(), data, forwarded_for_data.size() - 2);
+    }
+    if (!formatted)
+        return 0;
+    std::size_t size = std::strlen(data);
+    data[size++] = '\r';
+    data[size++] = '\n';
+    return size;
+}
+
 const channel& session::get_request_channel() const
 {
     return request_channel;
@@ -12,18 +12,29 @@
 #include <vector>
 #include <boost/smart_ptr.hpp>
 #include <boost/function.hpp>
+#include <boost/intrusive/list.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
 
 #include "channel.hpp"
 #include "resolver.hpp"
 #include "common.hpp"
 #include "high_resolution_timer.hpp"
+#include "session_pool.hpp"
+#include "framing.hpp"
 
 class proxy;
 
-class session : public boost::noncopyable
+// linked into proxy's session list by its base hook
+class session : public boost::intrusive::list_base_hook<>, public boost::noncopyable
 {
 public:
     session(asio::io_service& io, proxy& parent_proxy);
+    ~session();
+
+    // sessions are allocated from proxy's session_pool only
+    static void* operator new(std::size_t size, session_pool& pool);
+    static void operator delete(void* ptr, session_pool& pool);
+    static void operator delete(void* ptr);
 
     ip::tcp::socket& socket();
 
@@ -32,6 +43,8 @@ public:
 
     // called by channel (child)
     void finished_channel(const error_code& ec);
+    // channel started with limit spliced it
+    void finished_channel_limit(const channel& c);
 
     const channel& get_request_channel() const;
     const channel& get_response_channel() const;
@@ -39,23 +52,39 @@ public:
     const void* get_id() const;
 
 protected:
+    // request header is received until empty line, reads after the first one resume it
     void start_receive_header();
     void finished_receive_header(const error_code& ec, std::size_t bytes_transferred);
+    // header up to header_end is received, routes request
+    void finished_header(const char* header_end);
+    // moves header into pooled buffer, false if header can not grow
+    bool grow_header();
 
     void start_resolving(const char* peer);
     void finished_resolving(const error_code& ec, resolver::iterator begin, resolver::iterator end);
 
     void start_waiting_resolve_timer();
-    void finished_waiting_resolve_timer(const error_code& ec);
+    void finished_waiting_resolve_timer();
 
     void start_waiting_connect_timer();
-    void finished_waiting_connect_timer(const error_code& ec);
+    void finished_waiting_connect_timer();
 
     void start_sending_error(http_error_code httpec);
     void finished_sending_error(const error_code& ec, std::size_t bytes_transferred);
 
-    void start_connecting_to_peer(const ip::tcp::endpoint& peer);
+    // races connection attempts to peers (RFC 8305): next address is tried when
+    // previous attempt fails or does not succeed within connect attempt delay,
+    // first connected socket wins and becomes responder
+    void start_connecting(resolver::iterator begin, resolver::iterator end);
+    void start_connect_attempt();
+    void finished_connect_attempt(const error_code& ec, std::size_t attempt);
+    void finished_waiting_attempt_timer();
+    ip::tcp::socket& attempt_socket(std::size_t attempt);
+    void close_connect_attempts(std::size_t winner);
     void finished_connecting_to_peer(const error_code& ec);
+#ifdef HAVE_IO_URING
+    void finished_ring_connect(int result);
+#endif
 
     void start_sending_header();
     void finished_sending_header(const error_code& ec);
@@ -65,21 +94,48 @@ protected:
 
     void start_channels();
 
+    // With client keep-alive a request which can be framed is followed by
+    // its response, which is received and forwarded by session, bodies are
+    // spliced by channels with limit. Then the next request is received on
+    // the same client connection and routed to its own upstream connection.
+    // Requests which can not be framed are tunneled by channels as before.
+    void frame_request(const char* header_end);
+    void start_receive_response();
+    void finished_receive_response(const error_code& ec, std::size_t bytes_transferred);
+    // forwards received part of response, then splices or receives the rest
+    void continue_response();
+    // false if response header is malformed
+    bool frame_response(const char* begin, const char* header_end);
+    void finished_sending_response(const error_code& ec, std::size_t bytes_transferred);
+    void finished_response();
+    // fails response, client gets error page unless part of response is sent
+    void fail_response(const error_code& ec);
+    void start_next_request();
+    // empty lines before request on kept connection are ignored (RFC 7230 3.5)
+    bool skip_empty_lines();
+    void start_waiting_receive_timer();
+    void finished_waiting_receive_timer();
+
     void finish(const error_code& ec);
 
     const char* parse_header(std::size_t size);
     void prepare_header();
     void process_headers();
+    // formats client address followed by CRLF into forwarded_for_data, returns its size or 0
+    std::size_t format_forwarded_for();
 
 private:
     friend class channel;
 
     const static std::size_t http_header_head_max_size = 4096;
     const static std::uint16_t default_http_port = 80;
+    // IPv6 address, CRLF and zero
+    const static std::size_t forwarded_for_max_size = 48;
 
     enum method_type
     {
         CONNECT,
+        HEAD,
         OTHER,
     };
 
@@ -90,20 +146,74 @@ private:
     channel response_channel;
     // header info
     boost::array<char, http_header_head_max_size> header_data;
+    // header_data or buffer of proxy's header_pool
+    char* header_begin;
+    std::size_t header_size;
+    std::size_t header_capacity;
     std::uint16_t port;
     std::vector<asio::const_buffer> output_headers;
     asio::const_buffer headers_tail;
+    // value of X-Forwarded-For added by header rules
+    boost::array<char, forwarded_for_max_size> forwarded_for_data;
     method_type method;
+    // keep-alive state
+    const bool client_keep_alive;
+    // current request is framed, client connection is kept after its response
+    bool keep_alive;
+    std::size_t requests;
+    body_framing request_body;
+    // end of request in header buffer, next request starts there
+    std::size_t request_end;
+    // buffer of proxy's header_pool while response is forwarded
+    char* response_begin;
+    std::size_t response_size;
+    // bytes checked for end of header
+    std::size_t response_scanned;
+    // bytes belonging to response header and body
+    std::size_t response_parsed;
+    // bytes forwarded to client
+    std::size_t response_sent;
+    bool response_header_received;
+    // 1xx response, another one follows
+    bool response_interim;
+    bool response_upgrade;
+    bool response_close;
+    body_framing response_body;
 
     int opened_channels;
     boost::function<void (const error_code&, resolver::iterator, resolver::iterator)> resolve_handler;
+    // whole session, session_time covers all requests of kept connection
     util::high_resolution_timer timer;
+    // current request, other times are measured from its start
+    util::high_resolution_timer request_timer;
     error_code prev_ec;
     static logger log;
     const time_duration connect_timeout;
     const time_duration resolve_timeout;
-    asio::deadline_timer timeout_timer;
+    const time_duration connect_attempt_delay;
+    timing_wheel& wheel;
+    timing_wheel::timer timeout_timer;
+    // connection racing state, attempt n connects to peers[n]
+    ip::address peers[dns_cache::max_addresses];
+    std::size_t peers_count;
+    std::size_t next_peer;
+    std::size_t pending_attempts;
+    // finish waits for pending attempts
+    bool finishing;
+    error_code finish_ec;
+    // session timer values when attempts were started
+    double attempt_started[dns_cache::max_addresses];
+    // attempt 0 uses responder, later ones use racers[n - 1]
+    boost::ptr_vector<ip::tcp::socket> racers;
+    bool connected;
+    bool connect_expired;
+    error_code connect_ec;
+    timing_wheel::timer attempt_timer;
     int resolveid;
+    uring* ring;
+#ifdef HAVE_IO_URING
+    uring::operation connect_op;
+#endif
 };
 
 typedef boost::shared_ptr<session> session_ptr;
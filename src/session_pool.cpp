@@ -0,0 +1,94 @@
+/*
+ * session_pool.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <cstring>
+#include <new>
+
+#include "session_pool.hpp"
+#include "statistics.hpp"
+
+logger session_pool::log = logger(keywords::channel = "session_pool");
+
+static const statistics::counter session_pool_slabs_stat("session_pool_slabs");
+static const statistics::counter session_pool_in_use_stat("session_pool_in_use");
+static const statistics::counter session_pool_idle_stat("session_pool_idle");
+
+session_pool::session_pool(std::size_t object_size, std::size_t slab_size, std::size_t prealloc)
+    : object_size(object_size)
+    , slab_size(std::max<std::size_t>(slab_size, 1))
+    , free_list(0)
+    , in_use(0)
+{
+    std::size_t align = sizeof(slot_header);
+    slot_size = sizeof(slot_header) + (object_size + align - 1) / align * align;
+
+    while (prealloc > slabs.size() * this->slab_size)
+        add_slab();
+}
+
+session_pool::~session_pool()
+{
+    // Sessions of proxy are destroyed before their pool, but those still waiting
+    // in accept at shutdown are owned by their handlers only, which io_service
+    // drops without calling. Their sockets are not open yet, so their slots are
+    // released with the slabs without running destructors.
+    statistics::decrement(session_pool_in_use_stat, long(in_use));
+    statistics::decrement(session_pool_idle_stat, long(slabs.size() * slab_size - in_use));
+    statistics::decrement(session_pool_slabs_stat, long(slabs.size()));
+    for (std::vector<char*>::iterator it = slabs.begin(); it != slabs.end(); ++it)
+        delete[] *it;
+}
+
+void* session_pool::allocate(std::size_t size)
+{
+    assert(size <= object_size);
+    if (!free_list)
+        add_slab();
+
+    slot_header* slot = free_list;
+    free_list = slot->next;
+    slot->owner = this;
+    ++in_use;
+
+    statistics::decrement(session_pool_idle_stat);
+    statistics::increment(session_pool_in_use_stat);
+    return slot + 1;
+}
+
+void session_pool::deallocate(void* ptr)
+{
+    if (!ptr)
+        return;
+
+    slot_header* slot = static_cast<slot_header*>(ptr) - 1;
+    session_pool* pool = slot->owner;
+    slot->next = pool->free_list;
+    pool->free_list = slot;
+    --pool->in_use;
+
+    statistics::decrement(session_pool_in_use_stat);
+    statistics::increment(session_pool_idle_stat);
+}
+
+void session_pool::add_slab()
+{
+    TRACE() << slabs.size();
+    char* slab = new char[slot_size * slab_size];
+    // touch the whole slab now instead of page faulting on accept path
+    std::memset(slab, 0, slot_size * slab_size);
+    slabs.push_back(slab);
+
+    // free list is popped from the head, so slab is used from its start
+    for (std::size_t i = slab_size; i-- > 0;)
+    {
+        slot_header* slot = reinterpret_cast<slot_header*>(slab + i * slot_size);
+        slot->next = free_list;
+        free_list = slot;
+    }
+
+    statistics::increment(session_pool_slabs_stat);
+    statistics::increment(session_pool_idle_stat, long(slab_size));
+}
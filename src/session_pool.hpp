@@ -0,0 +1,56 @@
+/*
+ * session_pool.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef SESSION_POOL_HPP_
+#define SESSION_POOL_HPP_
+
+#include <cstddef>
+#include <vector>
+#include <boost/utility.hpp>
+
+#include "common.hpp"
+
+// Slab allocator for sessions of one proxy. Storage is carved from slabs of
+// equally sized slots and recycled through a free list, so once the pool is
+// warm accepting and finishing a session never reaches malloc. Every slot
+// remembers its pool, so storage can be freed by plain operator delete.
+// Not thread safe: a proxy allocates and frees its sessions on its own thread.
+class session_pool : public boost::noncopyable
+{
+public:
+    // object_size: size class served by the pool
+    // slab_size: number of slots allocated at once
+    // prealloc: number of slots allocated and touched at startup
+    session_pool(std::size_t object_size, std::size_t slab_size, std::size_t prealloc);
+    ~session_pool();
+
+    // object_size bytes at most
+    void* allocate(std::size_t size);
+    // returns storage obtained from allocate() to its pool
+    static void deallocate(void* ptr);
+
+private:
+    union slot_header
+    {
+        session_pool* owner;    // while slot is in use
+        slot_header* next;      // while slot is free
+        std::max_align_t align;
+    };
+
+    void add_slab();
+
+    std::size_t object_size;
+    std::size_t slot_size;
+    std::size_t slab_size;
+    std::vector<char*> slabs;
+    slot_header* free_list;
+    // slots handed out and not returned yet
+    std::size_t in_use;
+
+    static logger log;
+};
+
+#endif /* SESSION_POOL_HPP_ */
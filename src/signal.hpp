@@ -77,10 +77,20 @@ public:
     template<typename Handler>
     void async_wait(Handler handler)
     {
-        asio::async_read(read_sd, asio::mutable_buffers_1(signal_buffer, sizeof signal_buffer), boost::bind(handler, placeholders::error(), signal_buffer[0]));
+        waiting_handler = handler;
+        asio::async_read(read_sd, asio::mutable_buffers_1(signal_buffer, sizeof signal_buffer), boost::bind(&signal_waiter::finished_read, this, placeholders::error()));
     }
 
 private:
+    // signal number is in buffer only when read has completed
+    void finished_read(const error_code& ec)
+    {
+        // handler may wait again
+        signal_handler_type handler;
+        handler.swap(waiting_handler);
+        handler(ec, signal_buffer[0]);
+    }
+
     static void signal_handler(int signal)
     {
         instance->write_sd.write_some(asio::const_buffers_1(&signal, sizeof signal));
@@ -90,6 +100,7 @@ private:
     asio::posix::stream_descriptor write_sd;
     asio::posix::stream_descriptor read_sd;
     int signal_buffer[1];
+    signal_handler_type waiting_handler;
     typedef std::map<int, struct sigaction> sigactions_t;
     sigactions_t sigactions;
     static signal_waiter* instance;
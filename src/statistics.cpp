@@ -6,21 +6,63 @@
  */
 
 #include <iomanip>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
 #include <boost/bind.hpp>
 #include <boost/date_time.hpp>
 #include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
 #include <boost/filesystem.hpp>
 
 #include "statistics.hpp"
+#include "peer_scores.hpp"
 
 logger statistics::log = logger(keywords::channel = "statistics");
 statistics* statistics::instance_;
+__thread statistics::shard* statistics::local_shard;
+
+static const statistics::counter total_stat_sessions_stat("total_stat_sessions");
+static const statistics::counter current_stat_sessions_stat("current_stat_sessions");
 
 statistics& statistics::instance()
 {
     return *instance_;
 }
 
+statistics::counter::counter(const char* name, counter_type type)
+{
+    registry& r = get_registry();
+    id = r.names.size();
+    // counters added at startup (per name server ones) may not fit in shards
+    if (id >= max_counters)
+        throw std::length_error("too many statistics counters (limit is " + boost::lexical_cast<std::string>(std::size_t(max_counters)) + "), cannot add " + name);
+    r.names.push_back(name);
+    r.types.push_back(type);
+}
+
+statistics::registry& statistics::get_registry()
+{
+    // counters register themselves during static initialization of other translation units
+    static registry r;
+    return r;
+}
+
+statistics::shard* statistics::register_shard()
+{
+    void* memory;
+    if (posix_memalign(&memory, __alignof__(shard), sizeof(shard)) != 0)
+        throw std::bad_alloc();
+    shard* new_shard = new (memory) shard();
+    for (std::size_t id = 0; id < max_counters; ++id)
+        new_shard->values[id].store(0, std::memory_order_relaxed);
+
+    registry& r = get_registry();
+    std::lock_guard<std::mutex> lock(r.shards_mutex);
+    r.shards.push_back(new_shard);
+    return new_shard;
+}
+
 bool operator < (const statistics_session& lhs, const statistics_session& rhs)
 {
     return &lhs < &rhs;
@@ -74,8 +116,8 @@ void statistics::start_session(statistics_session* new_session)
     assert(inserted);
     new_session->start();
     start_accept();
-    statistics::increment("total_stat_sessions");
-    statistics::increment("current_stat_sessions");
+    statistics::increment(total_stat_sessions_stat);
+    statistics::increment(current_stat_sessions_stat);
 }
 
 void statistics::finished_session(statistics_session* session, const boost::system::error_code& ec)
@@ -85,7 +127,7 @@ void statistics::finished_session(statistics_session* session, const boost::syst
     if (c != 1)
         TRACE() << "erased " << c << " items. total " << sessions.size() << " items";
     assert(c == 1);
-    statistics::decrement("current_stat_sessions");
+    statistics::decrement(current_stat_sessions_stat);
 }
 
 std::string statistics::process_request(const std::string& request) const
@@ -94,17 +136,38 @@ std::string statistics::process_request(const std::string& request) const
 
     std::ostringstream response;
     split_vector_type tokens;
+    const registry& r = get_registry();
     if (request == "show stat")
     {
-        for (counters_t::const_iterator it = counters.begin(); it != counters.end(); ++it)
-            response << it->first << "\t";
+        for (std::size_t id = 0; id < r.names.size(); ++id)
+            response << r.names[id] << "\t";
         response.seekp(-1, std::ios_base::cur);
         response << "\n";
-        for (counters_t::const_iterator it = counters.begin(); it != counters.end(); ++it)
-            response << it->second << "\t";
+        for (std::size_t id = 0; id < r.names.size(); ++id)
+            response << sum(id) << "\t";
         response.seekp(-1, std::ios_base::cur);
         response << "\n";
     }
+    else if (boost::starts_with(request, "show peers"))
+    {
+        // show peers [count]
+        std::size_t count = 20;
+        boost::split(tokens, request, boost::is_any_of(" \t"), boost::token_compress_on);
+        try
+        {
+            if (tokens.size() > 2)
+                count = boost::lexical_cast<std::size_t>(tokens[2]);
+        }
+        catch (const boost::bad_lexical_cast& e)
+        {
+            response << "need_integer\n";
+            return response.str();
+        }
+        if (peer_scores* scores = peer_scores::instance())
+            scores->dump(response, count);
+        else
+            response << "disabled\n";
+    }
     else
     {
         boost::split(tokens, request, boost::is_any_of(" \t,"));
@@ -135,34 +198,25 @@ std::string statistics::process_request(const std::string& request) const
 
 statistics::value_t statistics::get_statistic(const std::string& name) const
 {
-    for (counters_t::const_iterator it = counters.begin(); it != counters.end(); ++it)
-        if (name.compare(it->first) == 0)
-            return it->second;
+    const registry& r = get_registry();
+    for (std::size_t id = 0; id < r.names.size(); ++id)
+        if (name.compare(r.names[id]) == 0)
+            return sum(id);
 
     throw boost::bad_index(name.c_str());
 }
 
-void statistics::increment(const char* name, long value)
+statistics::value_t statistics::sum(std::size_t id) const
 {
-    instance().add(name, value);
-}
-
-void statistics::decrement(const char* name, long value)
-{
-    instance().add(name, -value);
-}
-
-void statistics::increment(const char* name, double value)
-{
-    instance().add(name, value);
-}
+    registry& r = get_registry();
+    long total = 0;
+    {
+        std::lock_guard<std::mutex> lock(r.shards_mutex);
+        for (std::vector<shard*>::const_iterator it = r.shards.begin(); it != r.shards.end(); ++it)
+            total += (*it)->values[id].load(std::memory_order_relaxed);
+    }
 
-template<typename T>
-void statistics::add(const char* name, T value)
-{
-    auto counter = counters.find(name);
-    if (counter == counters.end())
-        counters[name] = value;
-    else
-        boost::get<T>(counter->second) += value;
+    if (r.types[id] == seconds)
+        return value_t(total * 1e-6);
+    return value_t(total);
 }
@@ -12,6 +12,8 @@
 #include <algorithm>
 #include <fstream>
 #include <numeric>
+#include <mutex>
+#include <atomic>
 #include <boost/ptr_container/ptr_map.hpp>
 #include <boost/ptr_container/ptr_set.hpp>
 #include <boost/asio.hpp>
@@ -23,6 +25,25 @@
 class statistics
 {
 public:
+    enum counter_type
+    {
+        integer,
+        seconds,        // accumulated in microseconds, reported as seconds
+    };
+
+    // Counter handle. Counters are registered once at startup (as namespace-scope
+    // objects of the translation unit which updates them), so updating a counter
+    // is just an addition to the calling thread's shard.
+    class counter
+    {
+    public:
+        explicit counter(const char* name, counter_type type = integer);
+
+    private:
+        friend class statistics;
+        std::size_t id;
+    };
+
     statistics(asio::io_service& io, const local::stream_protocol::endpoint& stat_ep);
     ~statistics();
 
@@ -30,9 +51,9 @@ public:
 
     static statistics& instance();
 
-    static void increment(const char* name, long value = 1);
-    static void decrement(const char* name, long value = 1);
-    static void increment(const char* name, double value);
+    static void increment(const counter& c, long value = 1);
+    static void decrement(const counter& c, long value = 1);
+    static void increment(const counter& c, double value);
 
     std::string process_request(const std::string& request) const;
 
@@ -45,20 +66,70 @@ protected:
     void start_session(statistics_session* new_session);
 
 private:
+    static const std::size_t max_counters = 256;
+
+    // Per-thread counter values, written only by the owning thread and summed on read.
+    // Relaxed atomic load and store compile to plain moves but keep reads of other
+    // threads' shards defined. Aligned to cache line to avoid false sharing between workers.
+    struct shard
+    {
+        std::atomic<long> values[max_counters];
+    } __attribute__((aligned(64)));
+
+    struct registry
+    {
+        std::vector<const char*> names;
+        std::vector<counter_type> types;
+        std::vector<shard*> shards;
+        std::mutex shards_mutex;
+    };
+
     typedef boost::variant<long, double> value_t;
     value_t get_statistic(const std::string& name) const;
+    value_t sum(std::size_t id) const;
 
-    template<typename T> void add(const char* name, T value);
+    static registry& get_registry();
+    static shard* register_shard();
+    static std::atomic<long>& local_value(const counter& c);
+    static void add(const counter& c, long value);
 
-    typedef std::map<const char*, value_t> counters_t;
-    counters_t counters;
     local::stream_protocol::acceptor acceptor;
 
     typedef boost::ptr_set<statistics_session> sessions_t;
     sessions_t sessions;
 
+    static __thread shard* local_shard;
     static statistics* instance_;
     static logger log;
 };
 
+inline std::atomic<long>& statistics::local_value(const counter& c)
+{
+    if (!local_shard)
+        local_shard = register_shard();
+    return local_shard->values[c.id];
+}
+
+// only owning thread writes its shard, so no read-modify-write is needed
+inline void statistics::add(const counter& c, long value)
+{
+    std::atomic<long>& v = local_value(c);
+    v.store(v.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+inline void statistics::increment(const counter& c, long value)
+{
+    add(c, value);
+}
+
+inline void statistics::decrement(const counter& c, long value)
+{
+    add(c, -value);
+}
+
+inline void statistics::increment(const counter& c, double value)
+{
+    add(c, long(value * 1e6));
+}
+
 #endif /* STATISTICS_HPP_ */
@@ -0,0 +1,469 @@
+/*
+ * stub_resolver.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <sys/socket.h>
+#include <errno.h>
+#include <cstring>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <udns.h>
+
+#include "stub_resolver.hpp"
+#include "statistics.hpp"
+
+logger stub_resolver::log = logger(keywords::channel = "stub_resolver");
+
+static const statistics::counter stub_sent_stat("stub_sent");
+static const statistics::counter stub_send_batches_stat("stub_send_batches");
+static const statistics::counter stub_send_failed_stat("stub_send_failed");
+static const statistics::counter stub_received_stat("stub_received");
+static const statistics::counter stub_receive_batches_stat("stub_receive_batches");
+static const statistics::counter stub_mismatched_stat("stub_mismatched");
+static const statistics::counter stub_timeouts_stat("stub_timeouts");
+static const statistics::counter stub_retries_stat("stub_retries");
+
+static const std::uint16_t dns_flag_response = 0x8000;
+static const std::uint16_t dns_flag_recursion_desired = 0x0100;
+static const std::size_t dns_header_size = 12;
+
+static std::uint16_t get16(const unsigned char* p)
+{
+    return std::uint16_t(p[0] << 8 | p[1]);
+}
+
+static std::uint32_t get32(const unsigned char* p)
+{
+    return std::uint32_t(p[0]) << 24 | std::uint32_t(p[1]) << 16 | std::uint32_t(p[2]) << 8 | p[3];
+}
+
+static unsigned char* put16(unsigned char* p, std::uint16_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value & 0xff;
+    return p + 2;
+}
+
+// returns position after name or 0 if name is malformed
+static std::size_t skip_name(const unsigned char* packet, std::size_t size, std::size_t pos)
+{
+    while (pos < size)
+    {
+        unsigned char length = packet[pos];
+        if (length == 0)
+            return pos + 1;
+        // compression pointer ends the name
+        if ((length & 0xc0) == 0xc0)
+            return pos + 2 <= size ? pos + 2 : 0;
+        if (length & 0xc0)
+            return 0;
+        pos += length + 1;
+    }
+    return 0;
+}
+
+stub_resolver::stub_resolver(asio::io_service& io, const ip::udp::endpoint& outbound, const std::vector<ip::udp::endpoint>& name_servers,
+        const config& conf, callback completion)
+    : name_servers(name_servers)
+    , conf(conf)
+    , completion(completion)
+    , flush_scheduled(false)
+    , timer(io)
+    , timer_armed(false)
+    , next_socket(0)
+    , next_server(0)
+    , random(std::random_device()())
+    , receive_buffers(max_batch * max_packet)
+{
+    // fixed source port can be bound once
+    std::size_t count = outbound.port() ? 1 : std::max<std::size_t>(conf.sockets, 1);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        sockets.push_back(new ip::udp::socket(io, outbound.protocol()));
+        sockets.back().bind(outbound);
+        asio::socket_base::non_blocking_io non_blocking(true);
+        sockets.back().io_control(non_blocking);
+    }
+    this->conf.attempts = std::max(conf.attempts, 1u);
+}
+
+void stub_resolver::start()
+{
+    for (std::size_t socket = 0; socket < sockets.size(); ++socket)
+        start_waiting_receive(socket);
+}
+
+bool stub_resolver::submit(const std::string& name, int type, void* data)
+{
+    std::size_t socket = next_socket++ % sockets.size();
+    key_t key = allocate_key(socket);
+    pending p;
+    p.packet_size = encode_query(name, type, key & 0xffff, p.packet);
+    if (p.packet_size == 0)
+        return false;
+
+    TRACE() << name << " " << type << " " << key;
+    p.type = type;
+    p.data = data;
+    p.server = next_server++ % name_servers.size();
+    p.attempts = 1;
+    p.deadline = asio::deadline_timer::traits_type::now() + conf.timeout;
+    queries.insert(pending_t::value_type(key, p));
+    unsent.push_back(key);
+    deadlines.push_back(std::make_pair(p.deadline, key));
+    schedule_flush();
+    if (!timer_armed)
+        start_waiting_timer();
+    return true;
+}
+
+stub_resolver::key_t stub_resolver::allocate_key(std::size_t socket)
+{
+    // random ids make spoofed responses unlikely to match
+    for (;;)
+    {
+        key_t key = key_t(socket) << 16 | (random() & 0xffff);
+        if (queries.find(key) == queries.end())
+            return key;
+    }
+}
+
+// returns packet size or 0 if name can not be encoded
+std::size_t stub_resolver::encode_query(const std::string& name, int type, std::uint16_t id, unsigned char* packet)
+{
+    unsigned char* p = put16(packet, id);
+    p = put16(p, dns_flag_recursion_desired);
+    p = put16(p, 1);    // questions
+    p = put16(p, 0);    // answers
+    p = put16(p, 0);    // authority records
+    p = put16(p, 1);    // additional records (OPT)
+
+    const char* label = name.c_str();
+    const char* end = label + name.size();
+    if (end != label && end[-1] == '.')
+        --end;
+    if (end == label || end - label > 253)
+        return 0;
+    while (label < end)
+    {
+        const char* dot = std::find(label, end, '.');
+        std::size_t length = dot - label;
+        if (length == 0 || length > 63)
+            return 0;
+        *p++ = length;
+        std::memcpy(p, label, length);
+        p += length;
+        label = dot == end ? end : dot + 1;
+    }
+    *p++ = 0;
+    p = put16(p, type);
+    p = put16(p, DNS_C_IN);
+
+    // EDNS0 OPT record advertising receive buffer size
+    *p++ = 0;
+    p = put16(p, DNS_T_OPT);
+    p = put16(p, max_packet);
+    p = put16(p, 0);    // extended rcode and version
+    p = put16(p, 0);    // flags
+    p = put16(p, 0);    // data length
+    return p - packet;
+}
+
+void stub_resolver::schedule_flush()
+{
+    if (flush_scheduled)
+        return;
+    flush_scheduled = true;
+    timer.get_io_service().post(boost::bind(&stub_resolver::flush, this));
+}
+
+void stub_resolver::flush()
+{
+    flush_scheduled = false;
+    // socket index is in high bits, so queries of one socket are adjacent
+    std::sort(unsent.begin(), unsent.end());
+    std::vector<key_t>::const_iterator it = unsent.begin();
+    while (it != unsent.end())
+    {
+        std::size_t socket = *it >> 16;
+        std::size_t count = 1;
+        while (count < max_batch && it + count != unsent.end() && (it[count] >> 16) == socket)
+            ++count;
+        send(socket, &*it, count);
+        it += count;
+    }
+    unsent.clear();
+}
+
+void stub_resolver::send(std::size_t socket, const key_t* keys, std::size_t count)
+{
+    mmsghdr messages[max_batch];
+    iovec buffers[max_batch];
+    std::size_t size = 0;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        pending_t::iterator it = queries.find(keys[i]);
+        // answered by a previous try before it was sent again
+        if (it == queries.end())
+            continue;
+        ip::udp::endpoint& server = name_servers[it->second.server];
+        buffers[size].iov_base = it->second.packet;
+        buffers[size].iov_len = it->second.packet_size;
+        std::memset(&messages[size], 0, sizeof(messages[size]));
+        messages[size].msg_hdr.msg_name = server.data();
+        messages[size].msg_hdr.msg_namelen = server.size();
+        messages[size].msg_hdr.msg_iov = &buffers[size];
+        messages[size].msg_hdr.msg_iovlen = 1;
+        ++size;
+    }
+
+    std::size_t sent = 0;
+    while (sent < size)
+    {
+        int result = sendmmsg(sockets[socket].native(), messages + sent, size - sent, MSG_DONTWAIT);
+        if (result < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            // unsent queries are retried when they time out
+            TRACE_ERROR(error_code(errno, boost::system::get_system_category()));
+            statistics::increment(stub_send_failed_stat, long(size - sent));
+            break;
+        }
+        sent += result;
+        statistics::increment(stub_send_batches_stat);
+    }
+    statistics::increment(stub_sent_stat, long(sent));
+}
+
+void stub_resolver::start_waiting_receive(std::size_t socket)
+{
+    sockets[socket].async_receive(asio::null_buffers(), boost::bind(&stub_resolver::finished_waiting_receive, this, placeholders::error, socket));
+}
+
+void stub_resolver::finished_waiting_receive(const error_code& ec, std::size_t socket)
+{
+    TRACE_ERROR(ec);
+    if (ec)
+        return;
+
+    mmsghdr messages[max_batch];
+    iovec buffers[max_batch];
+    sockaddr_storage senders[max_batch];
+    for (;;)
+    {
+        for (std::size_t i = 0; i < max_batch; ++i)
+        {
+            buffers[i].iov_base = &receive_buffers[i * max_packet];
+            buffers[i].iov_len = max_packet;
+            std::memset(&messages[i], 0, sizeof(messages[i]));
+            messages[i].msg_hdr.msg_name = &senders[i];
+            messages[i].msg_hdr.msg_namelen = sizeof(senders[i]);
+            messages[i].msg_hdr.msg_iov = &buffers[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        int received = recvmmsg(sockets[socket].native(), messages, max_batch, MSG_DONTWAIT, 0);
+        if (received < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                TRACE_ERROR(error_code(errno, boost::system::get_system_category()));
+            break;
+        }
+        statistics::increment(stub_receive_batches_stat);
+        statistics::increment(stub_received_stat, long(received));
+
+        for (int i = 0; i < received; ++i)
+        {
+            ip::udp::endpoint sender;
+            std::size_t sender_size = std::min<std::size_t>(messages[i].msg_hdr.msg_namelen, sender.capacity());
+            std::memcpy(sender.data(), &senders[i], sender_size);
+            sender.resize(sender_size);
+            process_response(socket, &receive_buffers[i * max_packet], messages[i].msg_len, sender);
+        }
+        if (std::size_t(received) < max_batch)
+            break;
+    }
+
+    start_waiting_receive(socket);
+}
+
+void stub_resolver::process_response(std::size_t socket, const unsigned char* packet, std::size_t size, const ip::udp::endpoint& sender)
+{
+    pending_t::iterator it = size < dns_header_size ? queries.end() : queries.find(key_t(socket) << 16 | get16(packet));
+    if (it == queries.end() || std::find(name_servers.begin(), name_servers.end(), sender) == name_servers.end())
+    {
+        statistics::increment(stub_mismatched_stat);
+        return;
+    }
+
+    answer result;
+    bool retry_query;
+    if (!parse_answer(it->second, packet, size, result, retry_query))
+    {
+        statistics::increment(stub_mismatched_stat);
+        return;
+    }
+    if (retry_query)
+        return retry(it, result.servfail);
+
+    void* data = it->second.data;
+    queries.erase(it);
+    completion(data, result);
+}
+
+// false if packet is not a response to query p
+bool stub_resolver::parse_answer(const pending& p, const unsigned char* packet, std::size_t size, answer& result, bool& retry_query) const
+{
+    std::uint16_t flags = get16(packet + 2);
+    if (!(flags & dns_flag_response) || get16(packet + 4) != 1)
+        return false;
+
+    // question must be the one which was sent, names are compared case insensitively
+    std::size_t question_size = p.packet_size - dns_header_size - 11;
+    if (size < dns_header_size + question_size)
+        return false;
+    for (std::size_t i = 0; i < question_size; ++i)
+    {
+        unsigned char c = packet[dns_header_size + i];
+        unsigned char expected = p.packet[dns_header_size + i];
+        if (c != expected && !(c >= 'A' && c <= 'Z' && c + ('a' - 'A') == expected))
+            return false;
+    }
+
+    retry_query = false;
+    result.error = 0;
+    result.servfail = false;
+    result.ttl = 0;
+    result.size = 0;
+    switch (flags & 0xf)
+    {
+        case 0:
+            break;
+        case 2:     // SERVFAIL
+            result.servfail = true;
+            retry_query = true;
+            return true;
+        case 5:     // REFUSED
+            retry_query = true;
+            return true;
+        case 3:
+            result.error = DNS_E_NXDOMAIN;
+            return true;
+        default:
+            result.error = DNS_E_PROTOCOL;
+            return true;
+    }
+
+    unsigned ttl = ~0u;
+    std::size_t pos = dns_header_size + question_size;
+    for (std::uint16_t count = get16(packet + 6); count > 0; --count)
+    {
+        pos = skip_name(packet, size, pos);
+        if (pos == 0 || pos + 10 > size)
+            break;
+        std::uint16_t type = get16(packet + pos);
+        std::uint16_t klass = get16(packet + pos + 2);
+        std::uint32_t record_ttl = get32(packet + pos + 4);
+        std::uint16_t length = get16(packet + pos + 8);
+        pos += 10;
+        if (pos + length > size)
+            break;
+
+        // addresses of CNAME targets are answers too
+        if (klass == DNS_C_IN && type == p.type && result.size < max_addresses)
+        {
+            if (type == DNS_T_A && length == 4)
+            {
+                ip::address_v4::bytes_type bytes;
+                std::memcpy(bytes.data(), packet + pos, bytes.size());
+                result.addresses[result.size++] = ip::address_v4(bytes);
+                ttl = std::min<unsigned>(ttl, record_ttl);
+            }
+            else if (type == DNS_T_AAAA && length == 16)
+            {
+                ip::address_v6::bytes_type bytes;
+                std::memcpy(bytes.data(), packet + pos, bytes.size());
+                result.addresses[result.size++] = ip::address_v6(bytes);
+                ttl = std::min<unsigned>(ttl, record_ttl);
+            }
+        }
+        pos += length;
+    }
+
+    if (result.size == 0)
+        result.error = DNS_E_NODATA;
+    else
+        result.ttl = ttl;
+    return true;
+}
+
+void stub_resolver::start_waiting_timer()
+{
+    if (deadlines.empty())
+        return;
+    timer_armed = true;
+    timer.expires_at(deadlines.front().first);
+    timer.async_wait(boost::bind(&stub_resolver::finished_waiting_timer, this, placeholders::error));
+}
+
+void stub_resolver::finished_waiting_timer(const error_code& ec)
+{
+    TRACE_ERROR(ec);
+    timer_armed = false;
+    if (ec)
+        return;
+
+    // tries retried below are served by this handler
+    timer_armed = true;
+    boost::posix_time::ptime now = asio::deadline_timer::traits_type::now();
+    while (!deadlines.empty() && deadlines.front().first <= now)
+    {
+        std::pair<boost::posix_time::ptime, key_t> deadline = deadlines.front();
+        deadlines.pop_front();
+        pending_t::iterator it = queries.find(deadline.second);
+        // answered queries and earlier tries of retried ones leave stale deadlines
+        if (it == queries.end() || it->second.deadline != deadline.first)
+            continue;
+        statistics::increment(stub_timeouts_stat);
+        retry(it, false);
+    }
+
+    timer_armed = false;
+    start_waiting_timer();
+}
+
+// next try goes to the next name server
+void stub_resolver::retry(pending_t::iterator it, bool servfail)
+{
+    pending& p = it->second;
+    if (p.attempts == conf.attempts)
+        return fail(it, DNS_E_TEMPFAIL, servfail);
+
+    TRACE() << it->first << " " << p.attempts;
+    statistics::increment(stub_retries_stat);
+    ++p.attempts;
+    p.server = (p.server + 1) % name_servers.size();
+    p.deadline = asio::deadline_timer::traits_type::now() + conf.timeout;
+    unsent.push_back(it->first);
+    deadlines.push_back(std::make_pair(p.deadline, it->first));
+    schedule_flush();
+    if (!timer_armed)
+        start_waiting_timer();
+}
+
+void stub_resolver::fail(pending_t::iterator it, int error, bool servfail)
+{
+    answer result;
+    result.error = error;
+    result.servfail = servfail;
+    result.ttl = 0;
+    result.size = 0;
+    void* data = it->second.data;
+    queries.erase(it);
+    completion(data, result);
+}
@@ -0,0 +1,123 @@
+/*
+ * stub_resolver.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef STUB_RESOLVER_HPP_
+#define STUB_RESOLVER_HPP_
+
+#include <cstdint>
+#include <deque>
+#include <random>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <boost/utility.hpp>
+#include <boost/asio.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+
+#include "common.hpp"
+
+// Built-in stub resolver sending A and AAAA queries to recursive name servers.
+// Queries are spread over several sockets with different source ports and
+// over name servers; queries submitted while handlers run are sent with one
+// sendmmsg per socket once per loop iteration, responses are drained with
+// recvmmsg. Every try has the same timeout, so tries wait in a FIFO queue
+// served by a single timer. Timed out and SERVFAIL queries are retried on
+// the next name server. Truncated responses are used as they are.
+class stub_resolver : public boost::noncopyable
+{
+public:
+    static const std::size_t max_addresses = 16;
+
+    struct config
+    {
+        // sockets with own source ports
+        std::size_t sockets;
+        // timeout of one try
+        time_duration timeout;
+        // tries of every query
+        unsigned attempts;
+    };
+
+    struct answer
+    {
+        // 0 or udns status (DNS_E_*)
+        int error;
+        // DNS_E_TEMPFAIL comes from SERVFAIL answer to the last try, not from timeout
+        bool servfail;
+        unsigned ttl;
+        std::size_t size;
+        ip::address addresses[max_addresses];
+    };
+
+    typedef void (*callback)(void* data, const answer& result);
+
+    // name servers must have address family of outbound
+    stub_resolver(asio::io_service& io, const ip::udp::endpoint& outbound, const std::vector<ip::udp::endpoint>& name_servers,
+            const config& conf, callback completion);
+
+    void start();
+
+    // type is DNS_T_A or DNS_T_AAAA, completion gets data; false if name is not valid
+    bool submit(const std::string& name, int type, void* data);
+
+private:
+    // query is addressed by socket index and DNS id
+    typedef std::uint32_t key_t;
+
+    struct pending
+    {
+        int type;
+        void* data;
+        std::size_t server;
+        unsigned attempts;
+        boost::posix_time::ptime deadline;
+        std::size_t packet_size;
+        unsigned char packet[512];
+    };
+
+    typedef std::unordered_map<key_t, pending> pending_t;
+
+    static const std::size_t max_batch = 64;
+    static const std::size_t max_packet = 1232;
+
+    key_t allocate_key(std::size_t socket);
+    static std::size_t encode_query(const std::string& name, int type, std::uint16_t id, unsigned char* packet);
+
+    void schedule_flush();
+    void flush();
+    void send(std::size_t socket, const key_t* keys, std::size_t count);
+
+    void start_waiting_receive(std::size_t socket);
+    void finished_waiting_receive(const error_code& ec, std::size_t socket);
+    void process_response(std::size_t socket, const unsigned char* packet, std::size_t size, const ip::udp::endpoint& sender);
+    bool parse_answer(const pending& p, const unsigned char* packet, std::size_t size, answer& result, bool& retry) const;
+
+    void start_waiting_timer();
+    void finished_waiting_timer(const error_code& ec);
+    void retry(pending_t::iterator it, bool servfail);
+    void fail(pending_t::iterator it, int error, bool servfail);
+
+    boost::ptr_vector<ip::udp::socket> sockets;
+    std::vector<ip::udp::endpoint> name_servers;
+    config conf;
+    callback completion;
+    pending_t queries;
+    // keys of queries waiting to be sent
+    std::vector<key_t> unsent;
+    bool flush_scheduled;
+    // tries in order of their deadlines, stale entries are skipped
+    std::deque<std::pair<boost::posix_time::ptime, key_t> > deadlines;
+    asio::deadline_timer timer;
+    bool timer_armed;
+    std::size_t next_socket;
+    std::size_t next_server;
+    std::mt19937 random;
+    std::vector<unsigned char> receive_buffers;
+
+    static logger log;
+};
+
+#endif /* STUB_RESOLVER_HPP_ */
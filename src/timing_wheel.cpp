@@ -0,0 +1,134 @@
+/*
+ * timing_wheel.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <boost/bind.hpp>
+
+#include "timing_wheel.hpp"
+#include "statistics.hpp"
+
+logger timing_wheel::log = logger(keywords::channel = "timing_wheel");
+
+static const statistics::counter expired_timers_stat("expired_timers");
+
+timing_wheel::timer::timer()
+    : expiry(0)
+{
+}
+
+void timing_wheel::timer::set_handler(const handler_t& handler)
+{
+    this->handler = handler;
+}
+
+bool timing_wheel::timer::pending() const
+{
+    return is_linked();
+}
+
+timing_wheel::timing_wheel(asio::io_service& io, const time_duration& resolution, std::size_t slots)
+    : tick_timer(io)
+    , resolution(resolution)
+    , current(0)
+{
+    assert(resolution.ticks() > 0);
+    std::size_t size = 1;
+    while (size < slots)
+        size <<= 1;
+    this->slots.reset(new slot_t[size]);
+    mask = size - 1;
+}
+
+void timing_wheel::start()
+{
+    start_time = asio::deadline_timer::traits_type::now();
+    start_waiting_tick();
+}
+
+timing_wheel::tick_t timing_wheel::now() const
+{
+    return current;
+}
+
+timing_wheel::tick_t timing_wheel::deadline(const time_duration& timeout) const
+{
+    // current tick is partially elapsed already, so one more tick is added
+    tick_t ticks = 0;
+    if (timeout.ticks() > 0)
+        ticks = (timeout.ticks() + resolution.ticks() - 1) / resolution.ticks();
+    return current + ticks + 1;
+}
+
+void timing_wheel::schedule(timer& t, const time_duration& timeout)
+{
+    schedule_at(t, deadline(timeout));
+}
+
+void timing_wheel::schedule_at(timer& t, tick_t expiry)
+{
+    t.unlink();
+    t.expiry = std::max(expiry, current + 1);
+    slots[t.expiry & mask].push_back(t);
+}
+
+void timing_wheel::cancel(timer& t)
+{
+    t.unlink();
+}
+
+void timing_wheel::start_waiting_tick()
+{
+    tick_timer.expires_at(start_time + time_duration(0, 0, 0, resolution.ticks() * (current + 1)));
+    tick_timer.async_wait(boost::bind(&timing_wheel::finished_waiting_tick, this, placeholders::error));
+}
+
+void timing_wheel::finished_waiting_tick(const error_code& ec)
+{
+    TRACE_ERROR(ec);
+    if (ec)
+        return;
+
+    // catch up with ticks missed while loop was busy
+    tick_t target = (asio::deadline_timer::traits_type::now() - start_time).ticks() / resolution.ticks();
+    if (target <= current)
+        target = current + 1;
+
+    slot_t expired;
+    if (target - current > mask)
+    {
+        for (std::size_t i = 0; i <= mask; ++i)
+            expire(slots[i], target, expired);
+    }
+    else
+    {
+        for (tick_t tick = current + 1; tick <= target; ++tick)
+            expire(slots[tick & mask], target, expired);
+    }
+    current = target;
+
+    // handlers may schedule or cancel any timer, including not yet fired ones
+    while (!expired.empty())
+    {
+        timer& t = expired.front();
+        expired.pop_front();
+        statistics::increment(expired_timers_stat);
+        t.handler();
+    }
+
+    start_waiting_tick();
+}
+
+void timing_wheel::expire(slot_t& slot, tick_t until, slot_t& expired)
+{
+    for (slot_t::iterator it = slot.begin(); it != slot.end();)
+    {
+        timer& t = *it++;
+        if (t.expiry <= until)
+        {
+            t.unlink();
+            expired.push_back(t);
+        }
+    }
+}
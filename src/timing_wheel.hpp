@@ -0,0 +1,81 @@
+/*
+ * timing_wheel.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef TIMING_WHEEL_HPP_
+#define TIMING_WHEEL_HPP_
+
+#include <boost/function.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/utility.hpp>
+#include <boost/intrusive/list.hpp>
+#include <boost/asio.hpp>
+
+#include "common.hpp"
+
+// Hashed timing wheel for coarse timeouts of one io_service. Scheduling,
+// rescheduling and cancelling a timer is O(1) list relinking, the wheel
+// itself is driven by a single deadline_timer ticking every resolution.
+// Timers fire no earlier than requested and at most one tick later.
+class timing_wheel : public boost::noncopyable
+{
+public:
+    typedef unsigned long tick_t;
+
+    typedef boost::intrusive::list_base_hook<boost::intrusive::link_mode<boost::intrusive::auto_unlink> > hook_t;
+
+    // Timer embedded into its owner, destroying it cancels it.
+    class timer : public hook_t, public boost::noncopyable
+    {
+    public:
+        typedef boost::function<void ()> handler_t;
+
+        timer();
+
+        void set_handler(const handler_t& handler);
+        bool pending() const;
+
+    private:
+        friend class timing_wheel;
+
+        tick_t expiry;
+        handler_t handler;
+    };
+
+    // slots is rounded up to power of two, timeouts longer than slots * resolution
+    // stay in their slot for several revolutions
+    timing_wheel(asio::io_service& io, const time_duration& resolution, std::size_t slots);
+
+    void start();
+
+    // current tick, advanced only by the wheel itself, so it is cheap enough
+    // to be used as "last activity" stamp on every operation
+    tick_t now() const;
+    // first tick when timeout started now is surely expired
+    tick_t deadline(const time_duration& timeout) const;
+
+    // (re)schedules timer, handler is called from io_service
+    void schedule(timer& t, const time_duration& timeout);
+    void schedule_at(timer& t, tick_t expiry);
+    void cancel(timer& t);
+
+private:
+    typedef boost::intrusive::list<timer, boost::intrusive::constant_time_size<false> > slot_t;
+
+    void start_waiting_tick();
+    void finished_waiting_tick(const error_code& ec);
+    void expire(slot_t& slot, tick_t until, slot_t& expired);
+
+    asio::deadline_timer tick_timer;
+    boost::posix_time::ptime start_time;
+    time_duration resolution;
+    tick_t current;
+    boost::scoped_array<slot_t> slots;
+    std::size_t mask;
+
+    static logger log;
+};
+
+#endif /* TIMING_WHEEL_HPP_ */
@@ -0,0 +1,402 @@
+/*
+ * uring.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifdef HAVE_IO_URING
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <boost/bind.hpp>
+
+#include "uring.hpp"
+#include "statistics.hpp"
+
+logger uring::log = logger(keywords::channel = "uring");
+
+static const statistics::counter uring_submits_stat("uring_submits");
+static const statistics::counter uring_sqes_stat("uring_sqes");
+static const statistics::counter uring_cqes_stat("uring_cqes");
+
+// user_data of intermediate requests of a link chain (poll before splice) has this bit set,
+// linked timeouts and cancel requests have zero user_data; their completions are not reported
+static const __u64 chain_head_tag = 1;
+
+static int io_uring_setup(unsigned entries, io_uring_params* params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, 0, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, const void* arg, unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void throw_errno(const char* what)
+{
+    throw system_error(error_code(errno, boost::system::get_system_category()), what);
+}
+
+uring::operation::operation()
+    : in_flight(false)
+    , multishot(false)
+    , fd(-1)
+    , address_size(0)
+{
+}
+
+uring::operation::operation(const handler_t& handler)
+    : handler(handler)
+    , in_flight(false)
+    , multishot(false)
+    , fd(-1)
+    , address_size(0)
+{
+}
+
+void uring::operation::set_handler(const handler_t& handler)
+{
+    this->handler = handler;
+}
+
+bool uring::operation::pending() const
+{
+    return in_flight;
+}
+
+bool uring::supported()
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = io_uring_setup(2, &params);
+    if (fd < 0)
+        return false;
+
+    const int required[] = { IORING_OP_POLL_ADD, IORING_OP_LINK_TIMEOUT, IORING_OP_ACCEPT,
+                             IORING_OP_CONNECT, IORING_OP_SPLICE, IORING_OP_ASYNC_CANCEL };
+    const std::size_t probe_size = sizeof(io_uring_probe) + IORING_OP_LAST * sizeof(io_uring_probe_op);
+    std::vector<char> buffer(probe_size);
+    io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(&buffer[0]);
+
+    bool result = io_uring_register(fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0;
+    for (std::size_t i = 0; result && i < sizeof(required) / sizeof(required[0]); ++i)
+        result = required[i] <= probe->last_op && (probe->ops[required[i]].flags & IO_URING_OP_SUPPORTED);
+
+    close(fd);
+    return result;
+}
+
+uring::uring(asio::io_service& io, unsigned entries)
+    : ring_fd(-1)
+    , event(io)
+    , submit_scheduled(false)
+    , multishot_accept(true)
+    , sq_ring(MAP_FAILED)
+    , sqes(static_cast<io_uring_sqe*>(MAP_FAILED))
+    , sq_local_tail(0)
+    , to_submit(0)
+    , cq_ring(MAP_FAILED)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+    ring_fd = io_uring_setup(entries, &params);
+    if (ring_fd < 0)
+        throw_errno("io_uring_setup");
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+
+    sq_ring = mmap(0, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED)
+        throw_errno("mmap sq ring");
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        cq_ring = sq_ring;
+    else
+    {
+        cq_ring = mmap(0, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if (cq_ring == MAP_FAILED)
+            throw_errno("mmap cq ring");
+    }
+
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = static_cast<io_uring_sqe*>(mmap(0, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+    if (sqes == MAP_FAILED)
+        throw_errno("mmap sqes");
+
+    char* sq = static_cast<char*>(sq_ring);
+    sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_entries = params.sq_entries;
+    sq_flags = reinterpret_cast<unsigned*>(sq + params.sq_off.flags);
+    sq_local_tail = *sq_tail;
+
+    // submission queue entries are always used in order
+    unsigned* array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    for (unsigned i = 0; i < sq_entries; ++i)
+        array[i] = i;
+
+    char* cq = static_cast<char*>(cq_ring);
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (efd < 0)
+        throw_errno("eventfd");
+    event.assign(efd);
+    if (io_uring_register(ring_fd, IORING_REGISTER_EVENTFD, &efd, 1) != 0)
+        throw_errno("io_uring_register eventfd");
+
+    start_waiting_completions();
+    TRACE() << "entries=" << params.sq_entries << " cq_entries=" << params.cq_entries;
+}
+
+uring::~uring()
+{
+    if (sqes != MAP_FAILED)
+        munmap(sqes, sqes_size);
+    if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+        munmap(cq_ring, cq_ring_size);
+    if (sq_ring != MAP_FAILED)
+        munmap(sq_ring, sq_ring_size);
+    if (ring_fd >= 0)
+        close(ring_fd);
+}
+
+void uring::async_accept(int fd, operation& op)
+{
+    op.fd = fd;
+    op.multishot = multishot_accept;
+    prepare_accept(op);
+    start_operation(op);
+}
+
+void uring::prepare_accept(operation& op)
+{
+    io_uring_sqe* sqe = get_sqe();
+    prepare(sqe, IORING_OP_ACCEPT, op.fd, reinterpret_cast<__u64>(&op));
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    if (op.multishot)
+        sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+}
+
+void uring::async_connect(int fd, const ip::tcp::endpoint& peer, const time_duration& timeout, operation& op)
+{
+    memcpy(&op.address, peer.data(), peer.size());
+    op.address_size = peer.size();
+
+    io_uring_sqe* sqe = get_sqe();
+    prepare(sqe, IORING_OP_CONNECT, fd, reinterpret_cast<__u64>(&op));
+    sqe->addr = reinterpret_cast<__u64>(&op.address);
+    sqe->off = op.address_size;
+    link_timeout(timeout, op);
+    start_operation(op);
+}
+
+void uring::async_poll(int fd, short events, const time_duration& timeout, operation& op)
+{
+    io_uring_sqe* sqe = get_sqe();
+    prepare(sqe, IORING_OP_POLL_ADD, fd, reinterpret_cast<__u64>(&op));
+    sqe->poll32_events = events;
+    link_timeout(timeout, op);
+    start_operation(op);
+}
+
+void uring::async_splice(int from, int to, std::size_t size, operation& op)
+{
+    io_uring_sqe* sqe = get_sqe();
+    prepare(sqe, IORING_OP_SPLICE, to, reinterpret_cast<__u64>(&op));
+    sqe->splice_fd_in = from;
+    sqe->splice_off_in = -1;
+    sqe->off = -1;
+    sqe->len = size;
+    sqe->splice_flags = SPLICE_F_NONBLOCK | SPLICE_F_MORE;
+    start_operation(op);
+}
+
+void uring::async_poll_splice(int poll_fd, short events, int from, int to, std::size_t size, operation& op)
+{
+    io_uring_sqe* sqe = get_sqe();
+    prepare(sqe, IORING_OP_POLL_ADD, poll_fd, reinterpret_cast<__u64>(&op) | chain_head_tag);
+    sqe->poll32_events = events;
+    sqe->flags |= IOSQE_IO_LINK;
+    async_splice(from, to, size, op);
+}
+
+void uring::cancel(operation& op)
+{
+    if (!op.in_flight)
+        return;
+
+    // request itself or head of its link chain
+    for (__u64 tag = 0; tag <= chain_head_tag; ++tag)
+    {
+        io_uring_sqe* sqe = get_sqe();
+        prepare(sqe, IORING_OP_ASYNC_CANCEL, -1, 0);
+        sqe->addr = reinterpret_cast<__u64>(&op) | tag;
+    }
+    schedule_submit();
+}
+
+void uring::link_timeout(const time_duration& timeout, operation& op)
+{
+    if (timeout <= time_duration())
+        return;
+
+    io_uring_sqe* sqe = &sqes[(sq_local_tail - 1) & sq_mask];
+    sqe->flags |= IOSQE_IO_LINK;
+
+    op.timeout.tv_sec = timeout.total_seconds();
+    op.timeout.tv_nsec = timeout.fractional_seconds() * (1000000000 / time_duration::ticks_per_second());
+
+    sqe = get_sqe();
+    prepare(sqe, IORING_OP_LINK_TIMEOUT, -1, 0);
+    sqe->addr = reinterpret_cast<__u64>(&op.timeout);
+    sqe->len = 1;
+}
+
+void uring::start_operation(operation& op)
+{
+    assert(!op.in_flight);
+    op.in_flight = true;
+    schedule_submit();
+}
+
+io_uring_sqe* uring::get_sqe()
+{
+    __sync_synchronize();
+    if (sq_local_tail - *sq_head >= sq_entries)
+        submit();
+
+    io_uring_sqe* sqe = &sqes[sq_local_tail & sq_mask];
+    ++sq_local_tail;
+    ++to_submit;
+    return sqe;
+}
+
+void uring::prepare(io_uring_sqe* sqe, int opcode, int fd, __u64 user_data)
+{
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = user_data;
+}
+
+void uring::schedule_submit()
+{
+    if (submit_scheduled)
+        return;
+    submit_scheduled = true;
+    event.get_io_service().post(boost::bind(&uring::submit, this));
+}
+
+void uring::submit()
+{
+    submit_scheduled = false;
+    if (to_submit == 0)
+        return;
+
+    __sync_synchronize();
+    *sq_tail = sq_local_tail;
+    __sync_synchronize();
+
+    statistics::increment(uring_submits_stat);
+    statistics::increment(uring_sqes_stat, long(to_submit));
+    while (to_submit > 0)
+    {
+        int submitted = io_uring_enter(ring_fd, to_submit, 0, 0);
+        if (submitted < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EBUSY)
+            {
+                // completion queue is full, make room and retry
+                reap();
+                continue;
+            }
+            throw_errno("io_uring_enter");
+        }
+        to_submit -= submitted;
+    }
+}
+
+void uring::start_waiting_completions()
+{
+    event.async_read_some(asio::null_buffers(), boost::bind(&uring::finished_waiting_completions, this, placeholders::error));
+}
+
+void uring::finished_waiting_completions(const error_code& ec)
+{
+    TRACE_ERROR(ec);
+    if (ec)
+        return;
+
+    eventfd_t value;
+    eventfd_read(event.native(), &value);
+    reap();
+    start_waiting_completions();
+}
+
+void uring::reap()
+{
+    for (;;)
+    {
+        __sync_synchronize();
+        unsigned head = *cq_head;
+        if (head == *cq_tail)
+        {
+            // completions which did not fit into the queue are flushed on enter
+            if (!(*sq_flags & IORING_SQ_CQ_OVERFLOW))
+                break;
+            io_uring_enter(ring_fd, 0, 0, IORING_ENTER_GETEVENTS);
+            continue;
+        }
+
+        io_uring_cqe cqe = cqes[head & cq_mask];
+        *cq_head = head + 1;
+        __sync_synchronize();
+
+        statistics::increment(uring_cqes_stat);
+        if (cqe.user_data == 0 || (cqe.user_data & chain_head_tag))
+            continue;
+
+        operation& op = *reinterpret_cast<operation*>(cqe.user_data);
+        bool more = op.multishot && (cqe.flags & IORING_CQE_F_MORE);
+
+        if (op.multishot && !more && cqe.res == -EINVAL && multishot_accept)
+        {
+            // kernel without multishot accept, fall back to one accept per request
+            BOOST_LOG_SEV(log, severity_level::info) << "multishot accept is not supported";
+            multishot_accept = false;
+            op.multishot = false;
+            prepare_accept(op);
+            schedule_submit();
+            continue;
+        }
+
+        op.in_flight = more;
+        op.handler(cqe.res, more);
+    }
+}
+
+#endif /* HAVE_IO_URING */
@@ -0,0 +1,116 @@
+/*
+ * uring.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef URING_HPP_
+#define URING_HPP_
+
+class uring;
+
+#ifdef HAVE_IO_URING
+
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+#include <boost/function.hpp>
+#include <boost/utility.hpp>
+#include <boost/asio.hpp>
+
+#include "common.hpp"
+
+// io_uring engine driven by asio: completions are signalled through an eventfd
+// watched by io_service, submissions queued while handlers run are flushed
+// with a single io_uring_enter once per loop iteration.
+class uring : public boost::noncopyable
+{
+public:
+    // Operation submitted to the ring. Owners embed operations and set handler once,
+    // handler receives result (>= 0 or -errno) and whether more completions of
+    // a multishot operation will follow. Owner must not be destroyed while
+    // operation is pending.
+    class operation : public boost::noncopyable
+    {
+    public:
+        typedef boost::function<void (int result, bool more)> handler_t;
+
+        operation();
+        explicit operation(const handler_t& handler);
+
+        void set_handler(const handler_t& handler);
+        bool pending() const;
+
+    private:
+        friend class uring;
+
+        handler_t handler;
+        bool in_flight;
+        bool multishot;
+        int fd;
+        __kernel_timespec timeout;
+        sockaddr_storage address;
+        socklen_t address_size;
+    };
+
+    uring(asio::io_service& io, unsigned entries);
+    ~uring();
+
+    // checks that kernel supports io_uring and all operations used by fastproxy
+    static bool supported();
+
+    void async_accept(int fd, operation& op);
+    void async_connect(int fd, const ip::tcp::endpoint& peer, const time_duration& timeout, operation& op);
+    // timeout is ignored if it is not positive
+    void async_poll(int fd, short events, const time_duration& timeout, operation& op);
+    void async_splice(int from, int to, std::size_t size, operation& op);
+    // splices as soon as poll_fd becomes ready
+    void async_poll_splice(int poll_fd, short events, int from, int to, std::size_t size, operation& op);
+    void cancel(operation& op);
+
+    // flushes queued submissions
+    void submit();
+
+private:
+    io_uring_sqe* get_sqe();
+    void prepare(io_uring_sqe* sqe, int opcode, int fd, __u64 user_data);
+    void prepare_accept(operation& op);
+    void link_timeout(const time_duration& timeout, operation& op);
+    void start_operation(operation& op);
+
+    void schedule_submit();
+    void start_waiting_completions();
+    void finished_waiting_completions(const error_code& ec);
+    void reap();
+
+    int ring_fd;
+    asio::posix::stream_descriptor event;
+    bool submit_scheduled;
+    bool multishot_accept;
+
+    // submission queue
+    void* sq_ring;
+    std::size_t sq_ring_size;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned* sq_flags;
+    io_uring_sqe* sqes;
+    std::size_t sqes_size;
+    unsigned sq_local_tail;
+    unsigned to_submit;
+
+    // completion queue
+    void* cq_ring;
+    std::size_t cq_ring_size;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    io_uring_cqe* cqes;
+
+    static logger log;
+};
+
+#endif /* HAVE_IO_URING */
+
+#endif /* URING_HPP_ */
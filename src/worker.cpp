@@ -0,0 +1,75 @@
+/*
+ * worker.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <boost/bind.hpp>
+
+#include "worker.hpp"
+#include "proxy.hpp"
+#include "statistics.hpp"
+
+logger worker::log = logger(keywords::channel = "worker");
+
+static const statistics::counter runs_stat("runs");
+static const statistics::counter loops_stat("loops");
+
+worker::worker()
+    : io(1)
+{
+}
+
+worker::~worker()
+{
+    stop();
+    join();
+}
+
+asio::io_service& worker::get_io_service()
+{
+    return io;
+}
+
+void worker::set_proxy(proxy* new_proxy)
+{
+    p.reset(new_proxy);
+}
+
+void worker::start()
+{
+    thread = std::thread(boost::bind(&worker::run_thread, this));
+}
+
+void worker::stop()
+{
+    io.stop();
+}
+
+void worker::join()
+{
+    if (thread.joinable())
+        thread.join();
+}
+
+void worker::run_thread()
+{
+    p->start();
+    TRACE() << "started";
+    run(io);
+    TRACE() << "stopped";
+}
+
+void worker::run(asio::io_service& io)
+{
+    for (;;)
+    {
+        if (io.poll() == 0)
+        {
+            if (io.run_one() == 0)
+                break;
+            statistics::increment(runs_stat);
+        }
+        statistics::increment(loops_stat);
+    }
+}
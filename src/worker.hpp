@@ -0,0 +1,49 @@
+/*
+ * worker.hpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#ifndef WORKER_HPP_
+#define WORKER_HPP_
+
+#include <memory>
+#include <thread>
+#include <boost/asio.hpp>
+#include <boost/utility.hpp>
+
+#include "common.hpp"
+
+class proxy;
+
+// Event loop running in a dedicated thread. Every worker owns its io_service
+// and its proxy (listeners, resolver and sessions), so nothing is shared
+// between workers except statistics.
+class worker : public boost::noncopyable
+{
+public:
+    worker();
+    ~worker();
+
+    asio::io_service& get_io_service();
+
+    // takes ownership of proxy created on get_io_service()
+    void set_proxy(proxy* new_proxy);
+
+    void start();
+    void stop();
+    void join();
+
+    // runs io until it is stopped or runs out of work
+    static void run(asio::io_service& io);
+
+private:
+    void run_thread();
+
+    asio::io_service io;
+    std::unique_ptr<proxy> p;
+    std::thread thread;
+    static logger log;
+};
+
+#endif /* WORKER_HPP_ */
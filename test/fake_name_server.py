@@ -0,0 +1,219 @@
+'''
+Created on Oct 17, 2026
+
+Local stand-in for a recursive name server. It answers A and AAAA queries of
+any name with made up addresses after configured latency, drops some of the
+queries (or just the first ones) and fails some of the names, so that resolver
+can be measured without network.
+'''
+import heapq
+import optparse
+import random
+import select
+import signal
+import socket
+import struct
+import sys
+import time
+import zlib
+
+DNS_T_A = 1
+DNS_T_AAAA = 28
+DNS_T_OPT = 41
+DNS_C_IN = 1
+
+NOERROR = 0
+SERVFAIL = 2
+NXDOMAIN = 3
+NOTIMP = 4
+
+FLAG_QR = 0x8000
+FLAG_TC = 0x0200
+FLAG_RD = 0x0100
+FLAG_RA = 0x0080
+
+
+class FakeNameServer(object):
+    def __init__(self, address='127.0.0.1', port=5353, latency=0.0, jitter=0.0, loss=0.0, servfail=0.0,
+                 nxdomain=0.0, ttl=300, answers=1, seed=1, drop_first=0):
+        self.sock = socket.socket(socket.AF_INET6 if ':' in address else socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4 * 1024 * 1024)
+        self.sock.bind((address, port))
+        self.sock.setblocking(False)
+        self.port = self.sock.getsockname()[1]
+        self.latency = latency
+        self.jitter = jitter
+        self.loss = loss
+        self.drop_first = drop_first
+        self.servfail = servfail
+        self.nxdomain = nxdomain
+        self.ttl = ttl
+        self.answers = answers
+        self.random = random.Random(seed)
+        # responses waiting for their latency to pass: (time, sequence, packet, address)
+        self.delayed = []
+        self.sequence = 0
+        self.stat = dict(received=0, dropped=0, malformed=0, answered=0, truncated=0)
+        self.running = True
+
+    def serve_forever(self):
+        while self.running:
+            # wakes up now and then to notice stop
+            timeout = 0.1
+            if self.delayed:
+                timeout = min(timeout, max(0, self.delayed[0][0] - time.time()))
+            try:
+                readable = select.select([self.sock], [], [], timeout)[0]
+            except select.error:
+                continue
+            if readable:
+                self._receive()
+            self._send_due()
+
+    def stop(self, *args):
+        self.running = False
+
+    def _receive(self):
+        while True:
+            try:
+                packet, address = self.sock.recvfrom(4096)
+            except socket.error:
+                return
+            self.stat['received'] += 1
+            if self.drop_first > 0:
+                self.drop_first -= 1
+                self.stat['dropped'] += 1
+                continue
+            if self.random.random() < self.loss:
+                self.stat['dropped'] += 1
+                continue
+            response = self.respond(bytearray(packet))
+            if response is None:
+                self.stat['malformed'] += 1
+                continue
+            delay = self.latency + self.random.uniform(-self.jitter, self.jitter)
+            if delay <= 0:
+                self._send(response, address)
+            else:
+                self.sequence += 1
+                heapq.heappush(self.delayed, (time.time() + delay, self.sequence, response, address))
+
+    def _send_due(self):
+        now = time.time()
+        while self.delayed and self.delayed[0][0] <= now:
+            response, address = heapq.heappop(self.delayed)[2:]
+            self._send(response, address)
+
+    def _send(self, response, address):
+        try:
+            self.sock.sendto(bytes(response), address)
+            self.stat['answered'] += 1
+        except socket.error:
+            self.stat['dropped'] += 1
+
+    def respond(self, query):
+        '''Returns response to query or None if query is malformed.'''
+        if len(query) < 12:
+            return None
+        ident, flags, qdcount, ancount, nscount, arcount = struct.unpack('>HHHHHH', bytes(query[:12]))
+        if flags & FLAG_QR or qdcount != 1:
+            return None
+
+        # question name is copied as it is, answers point to it
+        offset = 12
+        labels = []
+        while offset < len(query) and query[offset] != 0:
+            size = query[offset]
+            if size > 63:
+                return None
+            labels.append(bytes(query[offset + 1:offset + 1 + size]))
+            offset += 1 + size
+        offset += 1
+        if offset + 4 > len(query):
+            return None
+        qtype, qclass = struct.unpack('>HH', bytes(query[offset:offset + 4]))
+        question = query[12:offset + 4]
+        name = b'.'.join(labels).lower()
+
+        payload = 512
+        edns = False
+        rest = offset + 4
+        if arcount and rest + 11 <= len(query) and query[rest] == 0:
+            rtype, rclass = struct.unpack('>HH', bytes(query[rest + 1:rest + 5]))
+            if rtype == DNS_T_OPT:
+                edns = True
+                payload = max(512, rclass)
+
+        rcode = NOERROR
+        records = []
+        if qclass != DNS_C_IN:
+            rcode = NOTIMP
+        elif qtype not in (DNS_T_A, DNS_T_AAAA):
+            pass
+        elif self.random.random() < self.servfail:
+            rcode = SERVFAIL
+        elif (zlib.crc32(name) & 0xffffffff) / float(0x100000000) < self.nxdomain:
+            rcode = NXDOMAIN
+        else:
+            records = self.records(name, qtype)
+
+        opt = bytearray()
+        if edns:
+            opt = bytearray(b'\x00' + struct.pack('>HHIH', DNS_T_OPT, 1232, 0, 0))
+
+        response_flags = FLAG_QR | (flags & (0x7800 | FLAG_RD)) | FLAG_RA | rcode
+        body = bytearray(question)
+        size = 12 + len(body) + len(opt)
+        count = 0
+        for record in records:
+            if size + len(record) > payload:
+                response_flags |= FLAG_TC
+                self.stat['truncated'] += 1
+                break
+            body += record
+            size += len(record)
+            count += 1
+        header = struct.pack('>HHHHHH', ident, response_flags, 1, count, 0, 1 if edns else 0)
+        return bytearray(header) + body + opt
+
+    def records(self, name, qtype):
+        '''Answer records of name, addresses are derived from name.'''
+        base = zlib.crc32(name) & 0xffffffff
+        result = []
+        for i in range(self.answers):
+            if qtype == DNS_T_A:
+                rdata = struct.pack('>I', (0x0a000000 | (base + i) & 0x00ffffff))
+            else:
+                rdata = struct.pack('>IIII', 0xfd000000, 0, base, i)
+            result.append(bytearray(b'\xc0\x0c' + struct.pack('>HHIH', qtype, DNS_C_IN, self.ttl, len(rdata)) + rdata))
+        return result
+
+
+def main():
+    parser = optparse.OptionParser()
+    parser.add_option('--address', default='127.0.0.1', help='listening address')
+    parser.add_option('--port', type='int', default=5353, help='listening port, 0 picks a free one')
+    parser.add_option('--latency', type='float', default=0.0, help='delay of responses (in milliseconds)')
+    parser.add_option('--jitter', type='float', default=0.0, help='delay varies uniformly by this much (in milliseconds)')
+    parser.add_option('--loss', type='float', default=0.0, help='fraction of queries dropped')
+    parser.add_option('--drop-first', type='int', default=0, help='number of the first queries dropped')
+    parser.add_option('--servfail', type='float', default=0.0, help='fraction of queries answered with SERVFAIL')
+    parser.add_option('--nxdomain', type='float', default=0.0, help='fraction of names which do not exist')
+    parser.add_option('--ttl', type='int', default=300, help='TTL of answers')
+    parser.add_option('--answers', type='int', default=1, help='addresses in every answer, large answers are truncated')
+    parser.add_option('--seed', type='int', default=1, help='seed of loss and failures')
+    options, args = parser.parse_args()
+
+    server = FakeNameServer(options.address, options.port, options.latency / 1000.0, options.jitter / 1000.0,
+                            options.loss, options.servfail, options.nxdomain, options.ttl, options.answers, options.seed,
+                            options.drop_first)
+    signal.signal(signal.SIGTERM, server.stop)
+    signal.signal(signal.SIGINT, server.stop)
+    sys.stdout.write('{0}\n'.format(server.port))
+    sys.stdout.flush()
+    server.serve_forever()
+    sys.stderr.write(' '.join('{0}={1}'.format(k, v) for k, v in sorted(server.stat.items())) + '\n')
+
+
+if __name__ == '__main__':
+    main()
@@ -10,36 +10,27 @@ import urllib
 import time
 import socket
 import signal
+import sys
 
-class Test(unittest.TestCase):
+class ProxyTest(unittest.TestCase):
     port = 32567
     timeout = 5
     stat_sock = '/tmp/stat.sock'
+    name_servers = ['95.108.198.4']
+    resolve_library = 'udns'
 
-    allowed_header      = 'AllowedHeader'
-    original_header     = 'OriginalHeader'
-    replacement_header  = 'MuchBetterHeader'
-
-    def setUp(self):
+    def start_proxy(self, options):
         self.fastproxy = subprocess.Popen('../build/release/src/fastproxy \
-            --ingoing-http=127.0.0.1:{0} --receive-timeout={1} --resolve-library=udns \
-            --udns-name-server=95.108.198.4 --allow-header={2} --rename-header={3}:{4} --ingoing-stat={5}'.format(
-                self.port, self.timeout, self.allowed_header, self.original_header, self.replacement_header, self.stat_sock),
+            --ingoing-http=127.0.0.1:{0} --receive-timeout={1} --resolve-library={5} \
+            {2} --ingoing-stat={3} {4}'.format(
+                self.port, self.timeout, ' '.join('--udns-name-server=' + s for s in self.name_servers),
+                self.stat_sock, options, self.resolve_library),
             shell=True, env={'LD_LIBRARY_PATH': '/usr/local/lib64'}, preexec_fn=os.setsid)
         time.sleep(1)
 
     def tearDown(self):
         os.killpg(self.fastproxy.pid, signal.SIGTERM)
 
-    def test_running(self):
-        self.assertFalse(self.fastproxy.poll())
-
-    def test_simple(self):
-        urllib.urlopen('http://ya.ru', proxies={'http': 'http://localhost:{0}'.format(self.port)})
-
-    def test_simple_ip(self):
-        urllib.urlopen('http://77.88.21.3', proxies={'http': 'http://localhost:{0}'.format(self.port)})
-
     def _send_request(self, headers=None, method='GET', host='localhost'):
         l = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
         l.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
@@ -51,7 +42,25 @@ class Test(unittest.TestCase):
         self.c.send(request)
         l.settimeout(1)
         s, addr = l.accept()
-        return s.recv(len(request))
+        return s.recv(len(request) + 1024)
+
+class Test(ProxyTest):
+    allowed_header      = 'AllowedHeader'
+    original_header     = 'OriginalHeader'
+    replacement_header  = 'MuchBetterHeader'
+
+    def setUp(self):
+        self.start_proxy('--allow-header={0} --rename-header={1}:{2}'.format(
+                self.allowed_header, self.original_header, self.replacement_header))
+
+    def test_running(self):
+        self.assertFalse(self.fastproxy.poll())
+
+    def test_simple(self):
+        urllib.urlopen('http://ya.ru', proxies={'http': 'http://localhost:{0}'.format(self.port)})
+
+    def test_simple_ip(self):
+        urllib.urlopen('http://77.88.21.3', proxies={'http': 'http://localhost:{0}'.format(self.port)})
 
     def test_http(self):
         request = self._send_request()
@@ -138,5 +147,237 @@ class Test(unittest.TestCase):
         self.stat.send('total_sessions current_sessions total_stat_sessions current_stat_sessions unexisting_stat\n')
         self.assertEqual(self.stat.recv(64), '2\t0\t1\t1\tunexisting_stat?\n')
 
+class HeaderRulesTest(ProxyTest):
+    def setUp(self):
+        self.start_proxy('--set-header="X-Tag: new" --add-header=X-Static:1 --forwarded-for=1 --via=fp')
+
+    def test_added_headers(self):
+        request = self._send_request()
+        self.assertEqual(request, 'GET / HTTP/1.0\r\nX-Tag: new\r\nX-Static: 1\r\nX-Forwarded-For: 127.0.0.1\r\nVia: 1.0 fp\r\n\r\n')
+
+    def test_set_header(self):
+        request = self._send_request('x-tag: old\r\nOther: test\r\n')
+        self.assertEqual(request, 'GET / HTTP/1.0\r\nOther: test\r\nX-Tag: new\r\nX-Static: 1\r\nX-Forwarded-For: 127.0.0.1\r\nVia: 1.0 fp\r\n\r\n')
+
+    def test_previous_proxies_kept(self):
+        request = self._send_request('X-Forwarded-For: 10.0.0.1\r\nVia: 1.0 other\r\n')
+        self.assertEqual(request, 'GET / HTTP/1.0\r\nX-Forwarded-For: 10.0.0.1\r\nVia: 1.0 other\r\n'
+                'X-Tag: new\r\nX-Static: 1\r\nX-Forwarded-For: 127.0.0.1\r\nVia: 1.0 fp\r\n\r\n')
+
+class KeepAliveTest(ProxyTest):
+    # bodies of at least 16 KB are spliced by proxy
+    spliced_size = 100000
+
+    def setUp(self):
+        self.start_proxy('--client-keep-alive=1')
+        self.l = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.l.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.l.bind(('localhost', self.port + 1))
+        self.l.listen(5)
+        self.l.settimeout(1)
+        self.c = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.c.connect(('localhost', self.port))
+        self.c.settimeout(1)
+
+    def tearDown(self):
+        self.c.close()
+        self.l.close()
+        ProxyTest.tearDown(self)
+
+    def _request(self, path, method=b'GET', body=b'', headers=b''):
+        if body:
+            headers += b'Content-Length: %d\r\n' % len(body)
+        return b'%s http://localhost:%d%s HTTP/1.1\r\nHost: localhost\r\n%s\r\n%s' % (
+                method, self.port + 1, path, headers, body)
+
+    def _receive(self, s, size):
+        data = b''
+        while len(data) < size:
+            chunk = s.recv(size - len(data))
+            if not chunk:
+                break
+            data += chunk
+        return data
+
+    # accepts next upstream connection, returns request received by it
+    def _accept(self):
+        s, addr = self.l.accept()
+        s.settimeout(1)
+        request = b''
+        while b'\r\n\r\n' not in request:
+            request += s.recv(4096)
+        header, body = request.split(b'\r\n\r\n', 1)
+        for line in header.split(b'\r\n'):
+            if line.lower().startswith(b'content-length:'):
+                body += self._receive(s, int(line.split(b':')[1]) - len(body))
+        return s, header + b'\r\n\r\n' + body
+
+    # sends response in parts, every part is received by proxy separately
+    def _respond(self, s, *parts):
+        for part in parts:
+            s.sendall(part)
+            time.sleep(0.05)
+        s.close()
+
+    def _exchange(self, path, parts, method=b'GET', body=b''):
+        self.c.sendall(self._request(path, method, body))
+        s, request = self._accept()
+        self.assertEqual(request, b'%s %s HTTP/1.1\r\nHost: localhost\r\n%s\r\n%s' % (
+                method, path, b'Content-Length: %d\r\n' % len(body) if body else b'', body))
+        self._respond(s, *parts)
+        response = b''.join(parts)
+        self.assertEqual(self._receive(self.c, len(response)), response)
+
+    # connection is still usable after previous response
+    def _check_kept(self):
+        self._exchange(b'/next', [b'HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello'])
+
+    def test_sequential_requests(self):
+        for path in (b'/first', b'/second'):
+            self._exchange(path, [b'HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello'])
+
+    def test_close_requested(self):
+        self.c.sendall(self._request(b'/', headers=b'Connection: close\r\n'))
+        s, request = self._accept()
+        self._respond(s, b'HTTP/1.1 200 OK\r\n\r\nhello')
+        self.assertEqual(self._receive(self.c, 1024), b'HTTP/1.1 200 OK\r\n\r\nhello')
+
+    def test_chunked_response(self):
+        self._exchange(b'/', [b'HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhello\r\n0\r\n\r\n'])
+        self._check_kept()
+
+    def test_chunked_response_split(self):
+        self._exchange(b'/', [b'HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n5\r',
+                b'\nhel', b'lo\r\n1', b'0;ext=1\r\n' + b'x' * 16 + b'\r', b'\n0\r\nX-Trailer: 1\r', b'\n\r\n'])
+        self._check_kept()
+
+    def test_spliced_chunked_response(self):
+        self._exchange(b'/', [b'HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n%x\r\n' % self.spliced_size,
+                b'y' * self.spliced_size, b'\r\n0\r\n\r\n'])
+        self._check_kept()
+
+    def test_request_body(self):
+        self._exchange(b'/', [b'HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n'], b'POST', b'b' * 100)
+        self._check_kept()
+
+    def test_spliced_request_body(self):
+        self._exchange(b'/', [b'HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n'], b'POST', b'b' * self.spliced_size)
+        self._check_kept()
+
+    def test_pipelined_requests(self):
+        self.c.sendall(self._request(b'/first', b'POST', b'body') + self._request(b'/second'))
+        for path, body in ((b'/first', b'body'), (b'/second', b'')):
+            s, request = self._accept()
+            self.assertTrue(request.startswith(b'%s %s HTTP/1.1\r\n' % (b'POST' if body else b'GET', path)))
+            self.assertTrue(request.endswith(b'\r\n\r\n' + body))
+            response = b'HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n%s' % (len(path), path)
+            self._respond(s, response)
+            self.assertEqual(self._receive(self.c, len(response)), response)
+        self._check_kept()
+
+    def test_bodyless_responses(self):
+        self._exchange(b'/', [b'HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\n'], b'HEAD')
+        self._check_kept()
+        self._exchange(b'/', [b'HTTP/1.1 204 No Content\r\n\r\n'])
+        self._check_kept()
+        self._exchange(b'/', [b'HTTP/1.1 304 Not Modified\r\nContent-Length: 5\r\n\r\n'])
+        self._check_kept()
+
+    def test_interim_response(self):
+        self._exchange(b'/', [b'HTTP/1.1 100 Continue\r\n\r\n', b'HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok'])
+        self._check_kept()
+
+class HostsFileTest(ProxyTest):
+    hosts_file = '/tmp/fastproxy_test.hosts'
+
+    def setUp(self):
+        with open(self.hosts_file, 'w') as f:
+            f.write('127.0.0.1 before.test\n')
+        self.start_proxy('--hosts-file={0}'.format(self.hosts_file))
+
+    def test_reload_on_sighup(self):
+        with open(self.hosts_file, 'w') as f:
+            f.write('127.0.0.1 after.test\n')
+        os.killpg(self.fastproxy.pid, signal.SIGHUP)
+        time.sleep(0.5)
+        os.killpg(self.fastproxy.pid, 0)
+        request = self._send_request(host='after.test')
+        self.assertEqual(request, 'GET / HTTP/1.0\r\n\r\n')
+
+        # the second one is not mistaken for other signal either
+        os.killpg(self.fastproxy.pid, signal.SIGHUP)
+        time.sleep(0.5)
+        request = self._send_request(host='after.test')
+        self.assertEqual(request, 'GET / HTTP/1.0\r\n\r\n')
+
+class NameServerTest(ProxyTest):
+    def start_name_server(self, latency, *options):
+        server = subprocess.Popen([sys.executable, os.path.join(os.path.dirname(os.path.abspath(__file__)), 'fake_name_server.py'),
+                '--port=0', '--latency={0}'.format(latency)] + list(options), stdout=subprocess.PIPE)
+        self.name_server_processes.append(server)
+        return '127.0.0.1:{0}'.format(int(server.stdout.readline()))
+
+    def tearDown(self):
+        ProxyTest.tearDown(self)
+        for server in self.name_server_processes:
+            server.terminate()
+            server.wait()
+
+class HedgeTest(NameServerTest):
+    def setUp(self):
+        self.name_server_processes = []
+        # the first server is tried first while no server has rtt, the second one answers hedge
+        self.name_servers = [self.start_name_server(3000), self.start_name_server(0)]
+        self.start_proxy('')
+        self.stat = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.stat.connect(self.stat_sock)
+
+    def _hedge_wins(self):
+        self.stat.send('dns_server0_hedge_wins dns_server1_hedge_wins\n')
+        return sum(int(value) for value in self.stat.recv(64).split())
+
+    def test_hedge_sent_after_hedge_delay(self):
+        self.c = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.c.connect(('localhost', self.port))
+        started = time.time()
+        self.c.send('GET http://hedge.test/ HTTP/1.0\r\n\r\n')
+        while self._hedge_wins() == 0 and time.time() - started < 3:
+            time.sleep(0.01)
+        # initial hedge delay is 0.1 second, udns retry timer fires after whole seconds
+        self.assertEqual(self._hedge_wins(), 1)
+        self.assertTrue(time.time() - started < 0.5)
+
+class NegativeCacheTest(NameServerTest):
+    resolve_library = 'builtin'
+
+    def setUp(self):
+        self.name_server_processes = []
+        # the first query goes unanswered, the next ones are answered
+        self.name_servers = [self.start_name_server(0, '--drop-first=1')]
+        self.start_proxy('--builtin-query-timeout=200 --builtin-query-attempts=1 --dns-cache-negative-ttl=60')
+        self.stat = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.stat.connect(self.stat_sock)
+
+    def _stats(self):
+        self.stat.send('dns_queries dns_cache_negative_hits\n')
+        return [int(value) for value in self.stat.recv(64).split()]
+
+    def test_timeout_is_not_cached(self):
+        self.c = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.c.connect(('localhost', self.port))
+        self.c.send('GET http://timeout.test/ HTTP/1.0\r\n\r\n')
+        self.c.settimeout(2)
+        self.assertTrue(self.c.recv(1024).startswith('HTTP/1.0 5'))
+        self.c.close()
+
+        # timed out lookup is repeated well within negative ttl
+        self.c = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.c.connect(('localhost', self.port))
+        self.c.send('GET http://timeout.test/ HTTP/1.0\r\n\r\n')
+        started = time.time()
+        while self._stats()[0] < 2 and time.time() - started < 2:
+            time.sleep(0.01)
+        self.assertEqual(self._stats(), [2, 0])
+
 if __name__ == "__main__":
     unittest.main()
@@ -0,0 +1,68 @@
+'''
+Created on Oct 17, 2026
+
+Runs resolver_bench of every DNS library against the same local fake name
+server and prints their results side by side. Options which are not known
+here are passed to resolver_bench, e.g.
+
+    python resolver_bench.py --latency=5 --loss=0.01 -- --rate=5000 --cancel-ratio=0.1
+'''
+import optparse
+import subprocess
+import sys
+import os
+
+SERVER_OPTIONS = ['address', 'latency', 'jitter', 'loss', 'servfail', 'nxdomain', 'ttl', 'answers', 'seed']
+
+
+def run_library(options, library, port, bench_args):
+    name_server = '{0}:{1}'.format(options.address, port)
+    if ':' in options.address:
+        name_server = '[{0}]:{1}'.format(options.address, port)
+    command = [options.bench, '--resolve-library=' + library, '--name-server=' + name_server] + bench_args
+    output = subprocess.check_output(command, env={'LD_LIBRARY_PATH': '/usr/local/lib64'})
+    if not isinstance(output, str):
+        output = output.decode()
+    return [line.split('\t', 1) for line in output.splitlines() if '\t' in line]
+
+
+def main():
+    parser = optparse.OptionParser(usage='%prog [options] [-- resolver_bench options]')
+    parser.add_option('--bench', default='../build/release/src/resolver_bench', help='resolver_bench binary')
+    parser.add_option('--libraries', default='udns,unbound', help='libraries to compare')
+    parser.add_option('--address', default='127.0.0.1', help='address of fake name server')
+    parser.add_option('--latency', default='1', help='delay of responses (in milliseconds)')
+    parser.add_option('--jitter', default='0', help='delay varies uniformly by this much (in milliseconds)')
+    parser.add_option('--loss', default='0', help='fraction of queries dropped')
+    parser.add_option('--servfail', default='0', help='fraction of queries answered with SERVFAIL')
+    parser.add_option('--nxdomain', default='0', help='fraction of names which do not exist')
+    parser.add_option('--ttl', default='300', help='TTL of answers')
+    parser.add_option('--answers', default='1', help='addresses in every answer')
+    parser.add_option('--seed', default='1', help='seed of loss and failures')
+    options, bench_args = parser.parse_args()
+
+    server_command = [sys.executable, os.path.join(os.path.dirname(os.path.abspath(__file__)), 'fake_name_server.py'), '--port=0']
+    server_command += ['--{0}={1}'.format(name, getattr(options, name)) for name in SERVER_OPTIONS]
+    server = subprocess.Popen(server_command, stdout=subprocess.PIPE)
+    try:
+        port = int(server.stdout.readline())
+        results = []
+        for library in options.libraries.split(','):
+            results.append((library, run_library(options, library, port, bench_args)))
+    finally:
+        server.terminate()
+        server.wait()
+
+    # libraries may fail with different errors, so rows of all of them are shown
+    names = []
+    for library, result in results:
+        for name, value in result:
+            if name not in names:
+                names.append(name)
+    values = [dict(result) for library, result in results]
+    for name in names:
+        sys.stdout.write('{0:<16}'.format(name) + ''.join('{0:>16}'.format(v.get(name, '-')) for v in values) + '\n')
+
+
+if __name__ == '__main__':
+    main()